@@ -0,0 +1,185 @@
+/*
+  ar - build an indexed library (SNAR) for sn-link
+ */
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <cstdio>
+#include <cstring>
+
+#include <unistd.h>
+#include <err.h>
+#include <sysexits.h>
+
+#include "sn.h"
+#include "library.h"
+
+void usage(int rv) {
+
+	fputs(
+		"sn-ar [-v] archive object file ...\n"
+		"      -v: be verbose\n"
+
+		, stdout
+	);
+
+	exit(rv);
+}
+
+namespace {
+
+	void put_32(std::vector<uint8_t> &v, uint32_t x) {
+		v.push_back(x);
+		v.push_back(x >> 8);
+		v.push_back(x >> 16);
+		v.push_back(x >> 24);
+	}
+
+	void set_32(std::vector<uint8_t> &v, size_t offset, uint32_t x) {
+		v[offset + 0] = x;
+		v[offset + 1] = x >> 8;
+		v[offset + 2] = x >> 16;
+		v[offset + 3] = x >> 24;
+	}
+
+	// returns the offset.
+	uint32_t put_name(std::vector<uint8_t> &v, std::string_view s) {
+		uint32_t offset = v.size();
+		if (s.size() > 255) s = s.substr(0, 255);
+		v.push_back(s.size());
+		v.insert(v.end(), s.begin(), s.end());
+		return offset;
+	}
+
+	void align(std::vector<uint8_t> &v) {
+		while (v.size() & 3) v.push_back(0);
+	}
+
+	std::string_view member_name(std::string_view s) {
+		auto ix = s.find_last_of("/\\:");
+		if (ix != s.npos) s.remove_prefix(ix + 1);
+		return s;
+	}
+
+	struct entry {
+		std::string_view name;
+		uint32_t hash = 0;
+		unsigned member = 0;
+	};
+}
+
+int main(int argc, char **argv) {
+
+	bool verbose = false;
+
+	int ch;
+	while ((ch = getopt(argc, argv, "vh")) != -1) {
+		switch(ch) {
+		case 'v': verbose = true; break;
+		case 'h': usage(0);
+		default: usage(EX_USAGE);
+		}
+	}
+
+	argc -= optind;
+	argv += optind;
+
+	if (argc < 2) usage(EX_USAGE);
+
+	std::string outfile = argv[0];
+	++argv;
+	--argc;
+
+
+	// only the symbols are needed.
+	std::vector<sn_unit> units(argc);
+	for (int i = 0; i < argc; ++i)
+		sn_parse_unit(argv[i], units[i], SN_SYMBOLS_ONLY);
+
+
+	unsigned count = 0;
+	for (const auto &u : units) count += u.globals.size();
+
+	// keep the load factor under 1/2.
+	uint32_t buckets = 8;
+	while (buckets < count * 2) buckets <<= 1;
+
+	std::vector<entry> table(buckets);
+	unsigned symbols = 0;
+
+	for (unsigned i = 0; i < units.size(); ++i) {
+		for (const auto &sym : units[i].globals) {
+			uint32_t h = snar::hash(sym.name);
+			uint32_t mask = buckets - 1;
+			for (uint32_t j = 0; ; ++j) {
+				auto &e = table[(h + j) & mask];
+				if (!e.member) {
+					e = entry{ sym.name, h, i + 1 };
+					++symbols;
+					break;
+				}
+				if (e.hash == h && e.name == sym.name) {
+					// the linker would only ever find the first one.
+					warnx("%s: Duplicate symbol %.*s (first defined in %s)",
+						argv[i], (int)sym.name.size(), sym.name.data(), argv[e.member - 1]
+					);
+					break;
+				}
+			}
+		}
+	}
+
+
+	// header, member table, bucket table, names, objects.
+	std::vector<uint8_t> data;
+	data.reserve(1024);
+
+	data.insert(data.end(), { 'S', 'N', 'A', 'R' });
+	put_32(data, snar::version);
+	put_32(data, argc);
+	put_32(data, snar::header_size);
+	put_32(data, buckets);
+	put_32(data, snar::header_size + argc * snar::member_size);
+
+	size_t member_table = data.size();
+	data.resize(data.size() + argc * snar::member_size + buckets * snar::bucket_size);
+	size_t bucket_table = member_table + argc * snar::member_size;
+
+	for (int i = 0; i < argc; ++i)
+		set_32(data, member_table + i * snar::member_size, put_name(data, member_name(argv[i])));
+
+	for (uint32_t i = 0; i < buckets; ++i) {
+		const auto &e = table[i];
+		if (!e.member) continue;
+		size_t offset = bucket_table + i * snar::bucket_size;
+		set_32(data, offset + 0, e.hash);
+		set_32(data, offset + 4, put_name(data, e.name));
+		set_32(data, offset + 8, e.member);
+	}
+
+	for (int i = 0; i < argc; ++i) {
+		const auto &u = units[i];
+		align(data);
+		size_t offset = member_table + i * snar::member_size;
+		set_32(data, offset + 4, data.size());
+		set_32(data, offset + 8, u.object_size());
+		data.insert(data.end(), u.object_data(), u.object_data() + u.object_size());
+	}
+
+	if (data.size() > UINT32_MAX) errx(1, "%s: Archive too large", outfile.c_str());
+
+
+	FILE *f = fopen(outfile.c_str(), "wb");
+	if (!f) err(1, "Unable to open %s", outfile.c_str());
+	if (fwrite(data.data(), 1, data.size(), f) != data.size() || fclose(f) != 0)
+		err(1, "Unable to write %s", outfile.c_str());
+
+	if (verbose) {
+		printf("%s: %d members, %u symbols, %u buckets, %u bytes\n",
+			outfile.c_str(), argc, symbols, buckets, (unsigned)data.size()
+		);
+	}
+
+	return 0;
+}
@@ -0,0 +1,471 @@
+/*
+ * Parsed unit cache.
+ *
+ * A snapshot of a decoded sn_unit, keyed by a hash of the object file.
+ * Everything is a fixed-size record.  Section data and names are stored
+ * as offsets into the object file (which is mapped anyway), so a
+ * snapshot can be loaded without running the record decoder.
+ *
+ * Snapshots are in native byte order.  A cache from another machine
+ * fails the header check and is treated as a miss.
+ */
+
+#include <string>
+#include <vector>
+#include <atomic>
+#include <cstring>
+#include <cstdio>
+
+#include <unistd.h>
+#include <fcntl.h>
+
+#include "sn.h"
+#include "util.h"
+
+namespace {
+
+	enum {
+		CACHE_VERSION = 4,
+		CACHE_BOM = 0x01020304,
+		NO_OFFSET = 0xffffffff, // ds
+	};
+
+	struct cache_string {
+		uint32_t offset;
+		uint32_t size;
+	};
+
+	struct cache_header {
+		char magic[4];
+		uint32_t version;
+		uint32_t bom;
+		uint32_t size; // object file size
+		uint64_t hash; // object file hash
+
+		uint32_t groups;
+		uint32_t files;
+		uint32_t sections;
+		uint32_t data;
+		uint32_t relocs;
+		uint32_t patches;
+		uint32_t tokens;
+		uint32_t locals;
+		uint32_t globals;
+		uint32_t externs;
+	};
+
+	struct cache_group {
+		uint32_t group_id;
+		uint32_t flags;
+		cache_string name;
+	};
+
+	struct cache_file {
+		uint32_t file_id;
+		cache_string name;
+	};
+
+	struct cache_section {
+		uint32_t section_id;
+		uint32_t group_id;
+		uint32_t flags;
+		uint32_t size;
+		uint32_t data_count;
+		uint32_t reloc_count;
+		uint32_t patch_count;
+		cache_string name;
+	};
+
+	struct cache_data {
+		uint32_t offset;
+		uint32_t size;
+	};
+
+	struct cache_reloc {
+		uint32_t type;
+		uint32_t address;
+		uint32_t offset; // of the record in the object file
+		uint32_t expr_offset;
+		uint32_t expr_size;
+	};
+
+	struct cache_patch {
+		uint32_t address;
+		uint32_t value;
+		uint32_t size;
+	};
+
+	struct cache_symbol {
+		uint32_t symbol_id;
+		uint32_t section_id;
+		uint32_t value;
+		cache_string name;
+	};
+
+	static_assert(sizeof(expr_token) == 8, "expr_token not packed");
+
+
+	std::string cache_path(const std::string &dir, uint64_t h) {
+		char buffer[24];
+		snprintf(buffer, sizeof(buffer), "/%016llx.snc", (unsigned long long)h);
+		return dir + buffer;
+	}
+
+
+	// reads fixed-size records from the snapshot, with bounds checks.
+	class reader {
+		const uint8_t *_data;
+		size_t _size;
+		size_t _offset = 0;
+
+	public:
+		reader(const uint8_t *data, size_t size) : _data(data), _size(size) {}
+
+		template<class T>
+		const T *read(size_t count) {
+			// snapshots are written 4-byte aligned; mapped data is page aligned.
+			size_t bytes = sizeof(T) * count;
+			if (_size - _offset < bytes) return nullptr;
+			const T *rv = reinterpret_cast<const T *>(_data + _offset);
+			_offset += bytes;
+			return rv;
+		}
+	};
+
+
+	class writer {
+		std::vector<uint8_t> _data;
+
+	public:
+		template<class T>
+		void write(const T &t) {
+			auto p = reinterpret_cast<const uint8_t *>(&t);
+			_data.insert(_data.end(), p, p + sizeof(T));
+		}
+
+		template<class T>
+		void write(const T *t, size_t count) {
+			auto p = reinterpret_cast<const uint8_t *>(t);
+			_data.insert(_data.end(), p, p + sizeof(T) * count);
+		}
+
+		const std::vector<uint8_t> &data() const {
+			return _data;
+		}
+	};
+
+
+	// resolves offsets into the object file, with bounds checks.
+	class loader {
+		const uint8_t *_base;
+		uint32_t _size;
+
+		static bool check(cache_string s, uint32_t size) {
+			return s.offset <= size && size - s.offset >= s.size;
+		}
+
+	public:
+		bool ok = true;
+
+		loader(const mapped_file &mf) : _base(mf.data()), _size(mf.size()) {}
+
+		std::string_view view(cache_string s) {
+			if (!check(s, _size)) { ok = false; return std::string_view(); }
+			return std::string_view((const char *)_base + s.offset, s.size);
+		}
+
+		const uint8_t *data(cache_data d) {
+			if (d.offset == NO_OFFSET) return nullptr;
+			if (!check(cache_string{ d.offset, d.size }, _size)) { ok = false; return nullptr; }
+			return _base + d.offset;
+		}
+	};
+
+
+	template<class V>
+	void load_symbols(loader &ld, const cache_symbol *p, uint32_t count, V &v) {
+		v.reserve(count);
+		for (uint32_t i = 0; i < count; ++i) {
+			auto &sym = v.emplace_back();
+			sym.symbol_id = p[i].symbol_id;
+			sym.section_id = p[i].section_id;
+			sym.value = p[i].value;
+			sym.name = ld.view(p[i].name);
+		}
+	}
+
+	bool load_snapshot(const mapped_file &snapshot, sn_unit &unit, uint64_t h) {
+
+		const auto &mf = unit.mapping;
+
+		reader rd(snapshot.data(), snapshot.size());
+
+		auto header = rd.read<cache_header>(1);
+		if (!header) return false;
+		if (memcmp(header->magic, "SNC", 4)) return false;
+		if (header->version != CACHE_VERSION || header->bom != CACHE_BOM) return false;
+		if (header->size != mf.size() || header->hash != h) return false;
+
+		auto groups = rd.read<cache_group>(header->groups);
+		auto files = rd.read<cache_file>(header->files);
+		auto sections = rd.read<cache_section>(header->sections);
+		auto data = rd.read<cache_data>(header->data);
+		auto relocs = rd.read<cache_reloc>(header->relocs);
+		auto patches = rd.read<cache_patch>(header->patches);
+		auto tokens = rd.read<expr_token>(header->tokens);
+		auto locals = rd.read<cache_symbol>(header->locals);
+		auto globals = rd.read<cache_symbol>(header->globals);
+		auto externs = rd.read<cache_symbol>(header->externs);
+
+		if (!groups || !files || !sections || !data || !relocs || !patches || !tokens || !locals || !globals || !externs)
+			return false;
+
+		loader ld(mf);
+
+		unit.groups.reserve(header->groups);
+		for (uint32_t i = 0; i < header->groups; ++i) {
+			auto &g = unit.groups.emplace_back();
+			g.group_id = groups[i].group_id;
+			g.flags = groups[i].flags;
+			g.name = ld.view(groups[i].name);
+		}
+
+		unit.files.reserve(header->files);
+		for (uint32_t i = 0; i < header->files; ++i) {
+			auto &f = unit.files.emplace_back();
+			f.file_id = files[i].file_id;
+			f.name = ld.view(files[i].name);
+		}
+
+		uint32_t data_index = 0;
+		uint32_t reloc_index = 0;
+		uint32_t patch_index = 0;
+		unit.sections.reserve(header->sections);
+		for (uint32_t i = 0; i < header->sections; ++i) {
+			const auto &cs = sections[i];
+			auto &s = unit.sections.emplace_back();
+
+			s.section_id = cs.section_id;
+			s.group_id = cs.group_id;
+			s.flags = cs.flags;
+			s.size = cs.size;
+			s.name = ld.view(cs.name);
+
+			if (header->data - data_index < cs.data_count) return false;
+			if (header->relocs - reloc_index < cs.reloc_count) return false;
+			if (header->patches - patch_index < cs.patch_count) return false;
+
+			s.data.reserve(cs.data_count);
+			for (uint32_t j = 0; j < cs.data_count; ++j) {
+				const auto &d = data[data_index++];
+				s.data.emplace_back(sn_data{ ld.data(d), d.size });
+			}
+
+			s.relocs.reserve(cs.reloc_count);
+			s.offsets.reserve(cs.reloc_count);
+			for (uint32_t j = 0; j < cs.reloc_count; ++j) {
+				const auto &cr = relocs[reloc_index++];
+				if (cr.expr_offset > header->tokens || header->tokens - cr.expr_offset < cr.expr_size)
+					return false;
+				if (!cr.expr_size || cr.expr_size > 0xffff || cr.type > 0xff) return false;
+				if (cr.offset < 6 || cr.offset >= mf.size()) return false;
+
+				auto &r = s.relocs.emplace_back();
+				r.type = cr.type;
+				r.address = cr.address;
+				r.expr_offset = cr.expr_offset;
+				r.expr_size = cr.expr_size;
+				s.offsets.push_back(cr.offset);
+			}
+
+			s.patches.reserve(cs.patch_count);
+			for (uint32_t j = 0; j < cs.patch_count; ++j) {
+				const auto &cp = patches[patch_index++];
+				if (cp.size > 4 || cp.address > s.size || s.size - cp.address < cp.size)
+					return false;
+
+				auto &p = s.patches.emplace_back();
+				p.address = cp.address;
+				p.value = cp.value;
+				p.size = cp.size;
+			}
+		}
+
+		unit.tokens.assign(tokens, tokens + header->tokens);
+
+		load_symbols(ld, locals, header->locals, unit.locals);
+		load_symbols(ld, globals, header->globals, unit.globals);
+		load_symbols(ld, externs, header->externs, unit.externs);
+
+		if (!ld.ok) return false;
+
+		unit.build_indexes();
+		return true;
+	}
+
+
+	cache_string view_string(const mapped_file &mf, std::string_view s) {
+		return cache_string{ (uint32_t)((const uint8_t *)s.data() - mf.data()), (uint32_t)s.size() };
+	}
+
+	template<class V>
+	void save_symbols(writer &w, const mapped_file &mf, const V &v) {
+		for (const auto &sym : v) {
+			cache_symbol cs = {};
+			cs.symbol_id = sym.symbol_id;
+			cs.section_id = sym.section_id;
+			cs.value = sym.value;
+			cs.name = view_string(mf, sym.name);
+			w.write(cs);
+		}
+	}
+
+	void save_snapshot(writer &w, const sn_unit &unit, uint64_t h) {
+
+		const auto &mf = unit.mapping;
+
+		cache_header header = {};
+		memcpy(header.magic, "SNC", 4);
+		header.version = CACHE_VERSION;
+		header.bom = CACHE_BOM;
+		header.size = mf.size();
+		header.hash = h;
+
+		header.groups = unit.groups.size();
+		header.files = unit.files.size();
+		header.sections = unit.sections.size();
+		for (const auto &s : unit.sections) {
+			header.data += s.data.size();
+			header.relocs += s.relocs.size();
+			header.patches += s.patches.size();
+		}
+		header.tokens = unit.tokens.size();
+		header.locals = unit.locals.size();
+		header.globals = unit.globals.size();
+		header.externs = unit.externs.size();
+
+		w.write(header);
+
+		for (const auto &g : unit.groups) {
+			cache_group cg = {};
+			cg.group_id = g.group_id;
+			cg.flags = g.flags;
+			cg.name = view_string(mf, g.name);
+			w.write(cg);
+		}
+
+		for (const auto &f : unit.files) {
+			cache_file cf = {};
+			cf.file_id = f.file_id;
+			cf.name = view_string(mf, f.name);
+			w.write(cf);
+		}
+
+		for (const auto &s : unit.sections) {
+			cache_section cs = {};
+			cs.section_id = s.section_id;
+			cs.group_id = s.group_id;
+			cs.flags = s.flags;
+			cs.size = s.size;
+			cs.data_count = s.data.size();
+			cs.reloc_count = s.relocs.size();
+			cs.patch_count = s.patches.size();
+			cs.name = view_string(mf, s.name);
+			w.write(cs);
+		}
+
+		for (const auto &s : unit.sections) {
+			for (const auto &d : s.data) {
+				cache_data cd = {};
+				cd.offset = d.data ? (uint32_t)(d.data - mf.data()) : NO_OFFSET;
+				cd.size = d.size;
+				w.write(cd);
+			}
+		}
+
+		for (const auto &s : unit.sections) {
+			for (size_t i = 0; i < s.relocs.size(); ++i) {
+				const auto &r = s.relocs[i];
+				cache_reloc cr = {};
+				cr.type = r.type;
+				cr.address = r.address;
+				cr.offset = s.offsets[i];
+				cr.expr_offset = r.expr_offset;
+				cr.expr_size = r.expr_size;
+				w.write(cr);
+			}
+		}
+
+		for (const auto &s : unit.sections) {
+			for (const auto &p : s.patches) {
+				cache_patch cp = {};
+				cp.address = p.address;
+				cp.value = p.value;
+				cp.size = p.size;
+				w.write(cp);
+			}
+		}
+
+		w.write(unit.tokens.data(), unit.tokens.size());
+
+		save_symbols(w, mf, unit.locals);
+		save_symbols(w, mf, unit.globals);
+		save_symbols(w, mf, unit.externs);
+	}
+
+}
+
+
+bool sn_cache_load(const std::string &dir, const std::string &path, sn_unit &unit) {
+
+	// (pipes aren't cached, and opening one here would consume it.)
+	if (sn_is_stream(path)) return false;
+
+	std::error_code ec;
+	auto &mf = unit.mapping;
+	mf.open(path, mapped_file::readonly, ec);
+	if (ec || !mf.is_open()) return false;
+
+	auto h = fnv1a(mf.data(), mf.size(), fnv64_basis);
+
+	mapped_file snapshot(cache_path(dir, h), mapped_file::readonly, ec);
+	if (ec || !snapshot.is_open()) return false;
+
+	unit.filename = path;
+	if (load_snapshot(snapshot, unit, h)) return true;
+
+	// corrupt or out of date -- start over.
+	unit.clear();
+	return false;
+}
+
+/*
+ * snapshots are written to a temporary file and renamed, so a concurrent
+ * link never sees a partial snapshot.  failures are ignored -- it's only
+ * a cache.
+ */
+void sn_cache_save(const std::string &dir, const sn_unit &unit) {
+
+	static std::atomic<unsigned> counter{0};
+
+	const auto &mf = unit.mapping;
+	if (!mf.is_open()) return;
+
+	auto h = fnv1a(mf.data(), mf.size(), fnv64_basis);
+
+	writer w;
+	save_snapshot(w, unit, h);
+
+	auto path = cache_path(dir, h);
+	auto tmp = path + "." + std::to_string(getpid()) + "." + std::to_string(counter++);
+
+	int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_BINARY, 0666);
+	if (fd < 0) return;
+
+	const auto &data = w.data();
+	auto ok = write(fd, data.data(), data.size());
+	close(fd);
+
+	if (ok != (ssize_t)data.size() || rename(tmp.c_str(), path.c_str()) < 0)
+		unlink(tmp.c_str());
+}
@@ -44,7 +44,7 @@ inline bool is_omf(unsigned x) {
 }
 
 
-void print(const std::vector<expr_token> &v) {
+void print(sn_const_expr v) {
 
 	for (const auto &e : v) {
 		switch (e.op & 0xff) {
@@ -76,18 +76,41 @@ void print(const std::vector<expr_token> &v) {
 }
 
 
-static inline uint32_t sn_bool(bool tf) { return tf ? 0xffffffff : 0; }
+namespace {
 
-void simplify(std::vector<expr_token> &v) {
+	/*
+	 * output stack for simplify, stored in place at the end of the expression.
+	 * it never holds more tokens than have been read, so it never
+	 * overwrites a token that hasn't been read yet.
+	 */
+	class tail_stack {
+		expr_token *_end;
+		unsigned _size = 0;
 
+	public:
+		tail_stack(sn_expr v) : _end(v.end()) {}
 
-	if (v.size() <= 1) return;
+		void push_back(const expr_token &e) {
+			_end[-1 - (int)_size] = e;
+			++_size;
+		}
+		void pop_back() { --_size; }
+		unsigned size() const { return _size; }
+		expr_token &operator[](unsigned i) { return _end[-1 - (int)i]; }
+	};
+}
+
+// returns the simplified expression, which is a sub-range at the end of v.
+sn_expr simplify(sn_expr v) {
 
-	std::vector<expr_token> out;
 
-	for (auto iter = v.rbegin(); iter != v.rend(); ++iter) {
+	if (v.size() <= 1) return v;
 
-		const auto &e = *iter;
+	tail_stack out(v);
+
+	for (unsigned i = v.size(); i--; ) {
+
+		const auto &e = v[i];
 
 		if (is_term(e.op)) {
 			out.push_back(e);
@@ -100,32 +123,7 @@ void simplify(std::vector<expr_token> &v) {
 		auto &b = out[out.size() - 1];
 
 		if (is_const(a.op) && is_const(b.op)) {
-			uint32_t value = 0;
-			switch(e.op) {
-				case OP_EQ: value = sn_bool(a.value == b.value); break;
-				case OP_NE: value = sn_bool(a.value != b.value); break;
-				case OP_LE: value = sn_bool(a.value <= b.value); break;
-				case OP_LT: value = sn_bool(a.value < b.value); break;
-				case OP_GE: value = sn_bool(a.value >= b.value); break;
-				case OP_GT: value = sn_bool(a.value > b.value); break;
-				case OP_ADD: value = a.value + b.value; break;
-				case OP_SUB: value = a.value - b.value; break;
-				case OP_MUL: value = a.value * b.value; break;
-				case OP_AND: value = a.value & b.value; break;
-				case OP_OR: value = a.value | b.value; break;
-				case OP_XOR: value = a.value ^ b.value; break;
-				case OP_LSHIFT: value = a.value << b.value; break;
-				case OP_RSHIFT: value = a.value >> b.value; break;
-
-				case OP_DIV: 
-					if (b.value == 0) value = 0;
-					else value = (int32_t)a.value / (int32_t)b.value;
-					break;
-				case OP_MOD:
-					if (b.value == 0) value = 0;
-					else value = std::abs((int32_t)a.value % (int32_t)b.value);
-					break;
-			}
+			uint32_t value = sn_eval(e.op, a.value, b.value);
 
 			out.pop_back();
 			out.pop_back();
@@ -173,19 +171,19 @@ void simplify(std::vector<expr_token> &v) {
 		// can't simplify...
 		out.push_back(e);
 	}
-	if (v.size() == out.size()) return;
-	std::reverse(out.begin(), out.end());
-	v = std::move(out);
+	return sn_expr{ v.end() - out.size(), out.size() };
 }
 
 
-void simplify(sn_reloc &r) {
-	simplify(r.expr);
+void simplify(sn_unit &u, sn_reloc &r) {
+	auto expr = simplify(u.expr(r));
+	r.expr_offset = expr.begin() - u.tokens.data();
+	r.expr_size = expr.size();
 
 	// remove truncation checks here....
 
-	const auto &a = r.expr.front();
-	if (r.expr.size() >= 3 && a.op == OP_AND) {
+	const auto &a = expr.front();
+	if (expr.size() >= 3 && a.op == OP_AND) {
 
 		unsigned size = 0;
 		bool check = false;
@@ -203,7 +201,7 @@ void simplify(sn_reloc &r) {
 		}
 
 
-		const auto &b = r.expr[1];
+		const auto &b = expr[1];
 		if (b.op != V_CONST) return;
 		bool tc = false;
 		if (b.value == 0xff && size == 1) tc = true;
@@ -219,8 +217,8 @@ void simplify(sn_reloc &r) {
 				case 3: r.type = RELOC_3; break;
 				}
 			}
-			r.expr.erase(r.expr.begin());
-			r.expr.erase(r.expr.begin());
+			r.expr_offset += 2;
+			r.expr_size -= 2;
 		}
 
 	}
@@ -229,19 +227,20 @@ void simplify(sn_reloc &r) {
 
 void print_reloc_info(const sn_unit &unit, const sn_section &section, const sn_reloc &reloc) {
 
-	printf("%s:%s:%04x\n", unit.filename.c_str(), section.name.c_str(), reloc.address - section.offset);
+	printf("%s:%.*s:%04x\n", unit.filename.c_str(),
+		(int)section.name.size(), section.name.data(), reloc.address - section.offset);
 
-	if (reloc.file_id) {
-		// can print object file + offset ... but i need to retain the original
-		// offset -- sn_reloc has been updated.
+	unsigned file_id, line;
+	sn_source_line(unit, section.offsets[&reloc - section.relocs.data()], file_id, line);
+	if (file_id) {
 		auto iter = std::find_if(unit.files.begin(), unit.files.end(), [=](const auto &f){
-			return f.file_id == reloc.file_id;
+			return f.file_id == file_id;
 		});
 		if (iter != unit.files.end())
-			printf("%s:%u\n", iter->name.c_str(), reloc.line);
+			printf("%.*s:%u\n", (int)iter->name.size(), iter->name.data(), line);
 	}
 
-	print(reloc.expr);
+	print(unit.expr(reloc));
 }
 
 void resolve(const std::vector<sn_unit> &units, std::vector<omf::segment> &segments) {
@@ -293,10 +292,11 @@ void resolve(const std::vector<sn_unit> &units, std::vector<omf::segment> &segme
 						errx(1, "Bad relocation type %02x", r.type);
 				}
 
-				const auto &a = r.expr.front();
+				auto expr = u.expr(r);
+				const auto &a = expr.front();
 
 				// constant expression?
-				if (r.expr.size() == 1 && is_const(a.op)) {
+				if (expr.size() == 1 && is_const(a.op)) {
 					uint32_t value = a.value;
 					uint32_t address = r.address;
 
@@ -339,7 +339,7 @@ void resolve(const std::vector<sn_unit> &units, std::vector<omf::segment> &segme
 				// same-bank jsr check
 				// OP_SUB OP_AND 0xff0000 SYMBOL(current segment) SYMBOL (jsr target)
 
-				if (r.expr.size() == 1 && is_omf(a.op)) {
+				if (expr.size() == 1 && is_omf(a.op)) {
 
 					// TODO -- handle pc-relative stuff here...
 
@@ -348,9 +348,9 @@ void resolve(const std::vector<sn_unit> &units, std::vector<omf::segment> &segme
 					is.segment_offset = a.value;
 					ok = true;
 
-				} else if (r.expr.size() == 3) {
-					const auto &b = r.expr[1];
-					const auto &c = r.expr[2];
+				} else if (expr.size() == 3) {
+					const auto &b = expr[1];
+					const auto &c = expr[2];
 
 					if (a.op == OP_RSHIFT && is_const(b.op) && is_omf(c.op)) {
 						is.shift = -b.value;
@@ -380,11 +380,11 @@ void resolve(const std::vector<sn_unit> &units, std::vector<omf::segment> &segme
 					}
 					#endif
 				}
-				else if (r.expr.size() == 5 && size == 2) {
-					const auto &b = r.expr[1];
-					const auto &c = r.expr[2];
-					const auto &d = r.expr[3];
-					const auto &e = r.expr[4];
+				else if (expr.size() == 5 && size == 2) {
+					const auto &b = expr[1];
+					const auto &c = expr[2];
+					const auto &d = expr[3];
+					const auto &e = expr[4];
 
 					if (a.op == OP_SUB && b.op == OP_AND && is_const(c.op) && c.value == 0xff0000 && is_omf(d.op) && is_omf(e.op)) {
 						if (d.op != e.op) {
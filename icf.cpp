@@ -0,0 +1,274 @@
+/*
+ * identical section folding.
+ *
+ * sections with the same group, name, flags, data (after patches) and
+ * relocations are folded into the first of them.  extern references are
+ * compared by name; section references are compared by the class of the
+ * section they reference, which is refined until it's stable, so
+ * identical code referencing identical tables folds too.
+ *
+ * only sections which are never written to are folded, since folded
+ * sections share memory.  that's known from the section name: .code,
+ * .text, .rodata(.*) and .const(.*), and any names given with -I.  a
+ * section with reserved space (ds, bss) is never folded, nor are .stack
+ * and .init, whatever they're called.
+ *
+ * a folded section isn't laid out.  it takes the segment and offset
+ * of the section it was folded into, so its symbols and any references
+ * to it resolve there.
+ */
+
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <thread>
+#include <atomic>
+#include <cstring>
+
+#include "sn.h"
+#include "util.h"
+
+unsigned kind_for_name(const std::string &name);
+
+namespace {
+
+	bool is_readonly_name(std::string_view name, const std::vector<std::string> &readonly) {
+		if (name == ".code" || name == ".text") return true;
+		if (name == ".rodata" || name.substr(0, 8) == ".rodata.") return true;
+		if (name == ".const" || name.substr(0, 7) == ".const.") return true;
+		return std::find(readonly.begin(), readonly.end(), name) != readonly.end();
+	}
+
+	struct signature {
+		unsigned unit = 0;
+		unsigned section = 0;
+		bool foldable = true;
+
+		unsigned group_name = 0;
+		uint64_t hash = 0;
+
+		std::vector<uint8_t> bytes;
+		std::vector<uint32_t> relocs; // type, address, normalized tokens
+		std::vector<unsigned> refs; // V_SECTION references (signature index)
+	};
+
+	// base = signature index of the unit's first section.
+	void sign(sn_unit &u, unsigned index, unsigned base, const std::vector<std::string> &readonly, signature &sig) {
+
+		auto &s = u.sections[index];
+
+		sig.section = index;
+
+		// (merged string sections are already folded.)
+		if (s.folded || s.bss_size || !is_readonly_name(s.name, readonly)) {
+			sig.foldable = false;
+			return;
+		}
+		if (kind_for_name(std::string(s.name))) {
+			sig.foldable = false;
+			return;
+		}
+		for (const auto &d : s.data) {
+			if (!d.data) {
+				sig.foldable = false;
+				return;
+			}
+		}
+
+		if (s.group_id) {
+			auto g = u.find_group(s.group_id);
+			if (!g) {
+				sig.foldable = false;
+				return;
+			}
+			sig.group_name = g->name_id;
+		}
+
+		sig.bytes.reserve(s.size);
+		for (const auto &d : s.data) {
+			sig.bytes.insert(sig.bytes.end(), d.data, d.data + d.size);
+		}
+		for (const auto &p : s.patches) {
+			uint32_t value = p.value;
+			for (unsigned i = 0; i < p.size; ++i, value >>= 8)
+				sig.bytes[p.address + i] = value;
+		}
+
+		for (const auto &r : s.relocs) {
+			auto expr = u.expr(r);
+			sig.relocs.push_back(r.type);
+			sig.relocs.push_back(r.address);
+			sig.relocs.push_back(expr.size());
+			for (const auto &e : expr) {
+				uint32_t value = e.value;
+				switch (e.op) {
+				case V_EXTERN: {
+					auto ee = u.find_extern(e.value);
+					if (!ee) sig.foldable = false;
+					else value = ee->name_id;
+					break;
+				}
+				case V_SECTION: {
+					auto ss = u.find_section(e.value);
+					if (!ss) sig.foldable = false;
+					else sig.refs.push_back(base + (ss - u.sections.data()));
+					value = 0;
+					break;
+				}
+				case V_CONST:
+					break;
+				default:
+					// operators have no value; anything else (group() etc) isn't folded.
+					if (e.op < OP_EQ || e.op > OP_MOD) sig.foldable = false;
+					break;
+				}
+				sig.relocs.push_back(e.op);
+				sig.relocs.push_back(value);
+			}
+		}
+
+		uint32_t fixed[] = { s.name_id, sig.group_name, s.flags, s.size, s.bss_size };
+		uint64_t h = fnv1a(fixed, sizeof(fixed), fnv64_basis);
+		h = fnv1a(sig.bytes.data(), sig.bytes.size(), h);
+		h = fnv1a(sig.relocs.data(), sig.relocs.size() * sizeof(uint32_t), h);
+		sig.hash = h;
+	}
+
+	bool same(const std::vector<sn_unit> &units, const signature &a, const signature &b) {
+		const auto &sa = units[a.unit].sections[a.section];
+		const auto &sb = units[b.unit].sections[b.section];
+
+		return a.hash == b.hash
+			&& sa.name_id == sb.name_id && a.group_name == b.group_name
+			&& sa.flags == sb.flags && sa.size == sb.size && sa.bss_size == sb.bss_size
+			&& a.bytes == b.bytes && a.relocs == b.relocs;
+	}
+}
+
+/*
+ * returns the number of sections folded.  bytes is set to the
+ * number of bytes saved.  readonly are the extra section names (-I)
+ * which may be folded.  signatures are computed with up to `jobs`
+ * threads; the result doesn't depend on it.
+ */
+unsigned fold_sections(std::vector<sn_unit> &units, unsigned jobs, const std::vector<std::string> &readonly, uint32_t &bytes) {
+
+	bytes = 0;
+
+	std::vector<unsigned> base(units.size() + 1);
+	for (unsigned i = 0; i < units.size(); ++i)
+		base[i + 1] = base[i] + units[i].sections.size();
+
+	std::vector<signature> sigs(base.back());
+
+	auto sign_unit = [&](unsigned i){
+		for (unsigned j = 0; j < units[i].sections.size(); ++j) {
+			auto &sig = sigs[base[i] + j];
+			sig.unit = i;
+			sign(units[i], j, base[i], readonly, sig);
+		}
+	};
+
+	if (jobs == 0) jobs = std::thread::hardware_concurrency();
+	if (jobs > units.size()) jobs = units.size();
+	if (jobs <= 1) {
+		for (unsigned i = 0; i < units.size(); ++i) sign_unit(i);
+	} else {
+		std::atomic<unsigned> next{0};
+		std::vector<std::thread> threads;
+		for (unsigned t = 0; t < jobs; ++t) {
+			threads.emplace_back([&](){
+				for (unsigned i; (i = next++) < units.size(); ) sign_unit(i);
+			});
+		}
+		for (auto &t : threads) t.join();
+	}
+
+
+	// initial classes, by contents.  class ids are assigned in section order.
+	const unsigned none = -1;
+	std::vector<unsigned> cls(sigs.size(), none);
+	std::vector<unsigned> leaders; // class -> first signature
+	std::unordered_map<uint64_t, std::vector<unsigned>> by_hash;
+
+	for (unsigned i = 0; i < sigs.size(); ++i) {
+		const auto &sig = sigs[i];
+		if (!sig.foldable) {
+			cls[i] = leaders.size();
+			leaders.push_back(i);
+			continue;
+		}
+		auto &v = by_hash[sig.hash];
+		for (auto c : v) {
+			if (same(units, sigs[leaders[c]], sig)) {
+				cls[i] = c;
+				break;
+			}
+		}
+		if (cls[i] == none) {
+			cls[i] = leaders.size();
+			v.push_back(cls[i]);
+			leaders.push_back(i);
+		}
+	}
+
+
+	// refine by the classes of the referenced sections until nothing splits.
+	for (;;) {
+		std::unordered_map<uint64_t, std::vector<unsigned>> keys;
+		std::vector<unsigned> next(sigs.size(), none);
+		std::vector<unsigned> next_leaders;
+
+		auto key_equal = [&](unsigned a, unsigned b){
+			if (cls[a] != cls[b]) return false;
+			const auto &ra = sigs[a].refs;
+			const auto &rb = sigs[b].refs;
+			for (unsigned k = 0; k < ra.size(); ++k) {
+				if (cls[ra[k]] != cls[rb[k]]) return false;
+			}
+			return true;
+		};
+
+		for (unsigned i = 0; i < sigs.size(); ++i) {
+			uint64_t h = fnv1a(&cls[i], sizeof(unsigned), fnv64_basis);
+			for (auto r : sigs[i].refs) h = fnv1a(&cls[r], sizeof(unsigned), h);
+
+			auto &v = keys[h];
+			for (auto c : v) {
+				if (key_equal(next_leaders[c], i)) {
+					next[i] = c;
+					break;
+				}
+			}
+			if (next[i] == none) {
+				next[i] = next_leaders.size();
+				v.push_back(next[i]);
+				next_leaders.push_back(i);
+			}
+		}
+
+		bool done = next_leaders.size() == leaders.size();
+		cls.swap(next);
+		leaders.swap(next_leaders);
+		if (done) break;
+	}
+
+
+	unsigned count = 0;
+	for (unsigned i = 0; i < sigs.size(); ++i) {
+		unsigned leader = leaders[cls[i]];
+		if (leader == i) continue;
+
+		auto &s = units[sigs[i].unit].sections[sigs[i].section];
+		s.folded = &units[sigs[leader].unit].sections[sigs[leader].section];
+
+		// the leader's relocations cover it.
+		s.relocs.clear();
+		s.offsets.clear();
+		s.patches.clear();
+
+		bytes += s.size;
+		++count;
+	}
+	return count;
+}
@@ -0,0 +1,197 @@
+#include "library.h"
+#include "sn.h"
+#include "util.h"
+
+#include <cstring>
+#include <stdexcept>
+
+#include <unistd.h>
+#include <fcntl.h>
+
+namespace {
+
+	constexpr unsigned member_header = 20;
+
+	std::string_view member_name(const uint8_t *p) {
+		size_t n = 8;
+		while (n && (p[n - 1] == ' ' || p[n - 1] == 0)) --n;
+		return std::string_view((const char *)p, n);
+	}
+
+	// a length byte and the characters.
+	std::string_view read_name(const uint8_t *begin, size_t size, uint32_t offset) {
+		if (offset >= size || size - offset - 1 < begin[offset])
+			throw std::runtime_error("Bad name offset");
+		return std::string_view((const char *)begin + offset + 1, begin[offset]);
+	}
+
+	void read_index(sn_library &lib) {
+
+		const uint8_t *begin = lib.mapping->data();
+		size_t size = lib.mapping->size();
+
+		if (size < snar::header_size) throw std::runtime_error("Unexpected EOF");
+
+		const uint8_t *p = begin + 4;
+		if (read_32(p) != snar::version) throw std::runtime_error("Unsupported SNAR version");
+
+		uint32_t members = read_32(p);
+		uint32_t member_table = read_32(p);
+		uint32_t buckets = read_32(p);
+		uint32_t bucket_table = read_32(p);
+
+		if (member_table > size || (size - member_table) / snar::member_size < members)
+			throw std::runtime_error("Bad member table");
+		if (!buckets || (buckets & (buckets - 1)) || bucket_table > size || (size - bucket_table) / snar::bucket_size < buckets)
+			throw std::runtime_error("Bad symbol table");
+
+		lib.members.reserve(members);
+		for (uint32_t i = 0; i < members; ++i) {
+			p = begin + member_table + i * snar::member_size;
+			uint32_t name = read_32(p);
+			uint32_t offset = read_32(p);
+			uint32_t length = read_32(p);
+			if (offset > size || size - offset < length)
+				throw std::runtime_error("Bad member offset");
+
+			auto &m = lib.members.emplace_back();
+			m.name = read_name(begin, size, name);
+			m.offset = offset;
+			m.size = length;
+		}
+
+		lib.buckets = begin + bucket_table;
+		lib.bucket_count = buckets;
+	}
+
+	void read_directory(sn_library &lib) {
+
+		const uint8_t *begin = lib.mapping->data();
+		size_t size = lib.mapping->size();
+
+		if (size >= 4 && !memcmp(begin, "SNAR", 4))
+			return read_index(lib);
+
+		if (size < 4 || memcmp(begin, "LIB\x01", 4))
+			throw std::runtime_error("Not an SN Library");
+
+		size_t offset = 4;
+		while (offset < size) {
+			const uint8_t *p = begin + offset;
+			size_t avail = size - offset;
+
+			if (avail < member_header) throw std::runtime_error("Unexpected EOF");
+
+			const uint8_t *q = p + 12;
+			uint32_t object = read_32(q);
+			uint32_t total = read_32(q);
+			if (object < member_header || total < object || total > avail)
+				throw std::runtime_error("Bad member header");
+
+			unsigned index = lib.members.size();
+			auto &m = lib.members.emplace_back();
+			m.name = member_name(p);
+			m.offset = offset + object;
+			m.size = total - object;
+
+			// exports
+			size_t i = member_header;
+			for(;;) {
+				if (i >= object) throw std::runtime_error("Bad member exports");
+				unsigned n = p[i++];
+				if (!n) break;
+				if (object - i < n) throw std::runtime_error("Bad member exports");
+				lib.symbols.emplace(std::string_view((const char *)p + i, n), index);
+				i += n;
+			}
+
+			offset += total;
+		}
+	}
+}
+
+uint32_t snar::hash(std::string_view s) {
+	return fnv1a(s.data(), s.size(), fnv32_basis);
+}
+
+bool sn_is_library(const std::string &path) {
+
+	// (checked before opening anything -- opening a fifo would consume it.)
+	if (sn_is_stream(path)) return false;
+
+	int fd = open(path.c_str(), O_RDONLY | O_BINARY);
+	if (fd < 0) return false;
+
+	char sig[4];
+	bool rv = read(fd, sig, 4) == 4 && (!memcmp(sig, "LIB\x01", 4) || !memcmp(sig, "SNAR", 4));
+
+	close(fd);
+	return rv;
+}
+
+bool sn_open_library(const std::string &path, sn_library &lib, std::string &error) {
+
+	std::error_code ec;
+	lib.filename = path;
+	lib.mapping = std::make_shared<mapped_file>();
+	lib.mapping->open(path, mapped_file::readonly, ec);
+	if (ec) {
+		error = "Unable to open " + path + ": " + ec.message();
+		return false;
+	}
+
+	try {
+		read_directory(lib);
+	} catch (std::runtime_error &e) {
+		error = path + ": " + e.what();
+		return false;
+	}
+	return true;
+}
+
+int sn_library::find(std::string_view name) const {
+
+	if (!buckets) {
+		auto iter = symbols.find(name);
+		return iter == symbols.end() ? -1 : (int)iter->second;
+	}
+
+	// the table was validated when it was opened, but not the entries.
+	const uint8_t *begin = mapping->data();
+	size_t size = mapping->size();
+
+	uint32_t h = snar::hash(name);
+	uint32_t mask = bucket_count - 1;
+	for (uint32_t i = 0; i < bucket_count; ++i) {
+		const uint8_t *b = buckets + ((h + i) & mask) * snar::bucket_size;
+
+		uint32_t hash = read_32(b);
+		uint32_t offset = read_32(b);
+		uint32_t m = read_32(b);
+		if (!m) return -1;
+		if (hash != h || m > members.size()) continue;
+
+		if (offset >= size || size - offset - 1 < begin[offset]) continue;
+		if (std::string_view((const char *)begin + offset + 1, begin[offset]) == name)
+			return m - 1;
+	}
+	return -1;
+}
+
+bool sn_library::load(unsigned index, sn_unit &unit, std::string &error) {
+
+	auto &m = members[index];
+	m.loaded = true;
+
+	// the unit points into the mapping (and keeps it open), like an object file.
+	unit.library = mapping;
+	unit.member = mapping->data() + m.offset;
+	unit.member_size = m.size;
+
+	std::string name = filename + "(" + std::string(m.name) + ")";
+	if (!m.size) {
+		error = name + ": Not an SN Object File";
+		return false;
+	}
+	return sn_parse_unit(name, unit, error);
+}
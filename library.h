@@ -0,0 +1,85 @@
+#ifndef __library_h__
+#define __library_h__
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <unordered_map>
+#include <memory>
+#include <cstdint>
+
+#include "mapped_file.h"
+
+struct sn_unit;
+
+/*
+ * sn-ar archives (SNAR) are indexed: a hash table of every exported
+ * symbol is built when the archive is written, so opening one only reads
+ * the header and member table, and lookups probe the table in place.
+ * all fields are 32-bit little endian; names are a length byte followed
+ * by the characters.
+ *
+ *	header: 'SNAR', version, member count, member table offset,
+ *	        bucket count (a power of 2), bucket table offset
+ *	member: name offset, object offset, object size
+ *	bucket: name hash, name offset, member index + 1 (0 = empty)
+ *
+ * buckets are probed linearly from hash & (count - 1).
+ */
+namespace snar {
+	constexpr uint32_t version = 1;
+	constexpr unsigned header_size = 24;
+	constexpr unsigned member_size = 12;
+	constexpr unsigned bucket_size = 12;
+
+	// FNV-1a
+	uint32_t hash(std::string_view s);
+}
+
+/*
+ * Psy-Q style library (LIB\x01).
+ *
+ * each member has a header with its name and the symbols it exports,
+ * followed by a LNK\x02 object:
+ *
+ *	char name[8]; // space padded
+ *	uint32_t date;
+ *	uint32_t offset; // of the object, from the start of the member
+ *	uint32_t size; // of the member, including the header
+ *	pstring exports[]; // terminated by an empty string
+ *
+ * only the directory is read when the library is opened.  members are
+ * decoded when they're needed to define an extern.
+ */
+struct sn_library {
+
+	struct member {
+		std::string_view name;
+		uint32_t offset = 0; // of the object data, in the library
+		uint32_t size = 0;
+		bool loaded = false;
+	};
+
+	std::string filename;
+	std::shared_ptr<mapped_file> mapping; // shared with the units loaded from it
+	std::vector<member> members;
+
+	// exported name -> member index.  the first member to export a name wins.
+	// (for SNAR archives, the bucket table is used instead.)
+	std::unordered_map<std::string_view, unsigned> symbols;
+	const uint8_t *buckets = nullptr;
+	uint32_t bucket_count = 0;
+
+	// returns the member index, or -1.
+	int find(std::string_view name) const;
+
+	// decode a member as a unit, named library(member).
+	bool load(unsigned index, sn_unit &unit, std::string &error);
+};
+
+// checks the signature (LIB\x01 or SNAR).  pipes and stdin are never libraries.
+bool sn_is_library(const std::string &path);
+
+bool sn_open_library(const std::string &path, sn_library &lib, std::string &error);
+
+#endif
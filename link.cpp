@@ -6,7 +6,10 @@
 #include <string>
 #include <algorithm>
 #include <unordered_map>
+#include <thread>
+#include <atomic>
 #include <cstdio>
+#include <cstring>
 
 #include <unistd.h>
 #include <err.h>
@@ -21,12 +24,18 @@
 
 #include "sn.h"
 #include "omf.h"
+#include "string_pool.h"
+#include "readahead.h"
+#include "library.h"
+#include "profile.h"
 
-extern void simplify(std::vector<expr_token> &v);
-extern void simplify(sn_reloc &r);
-extern void print(const std::vector<expr_token> &v);
+extern void simplify(sn_unit &u, sn_reloc &r);
 
 void resolve(const std::vector<sn_unit> &units, std::vector<omf::segment> &segments);
+unsigned fold_sections(std::vector<sn_unit> &units, unsigned jobs, const std::vector<std::string> &readonly, uint32_t &bytes);
+unsigned merge_strings(std::vector<sn_unit> &units, uint32_t &bytes);
+std::vector<unsigned> partition_graph(const std::vector<uint32_t> &sizes, const std::vector<unsigned> &kinds,
+	const std::vector<std::pair<unsigned, unsigned>> &pairs, const std::vector<unsigned> &weights, uint32_t capacity);
 
 int set_file_type(const std::string &path, uint16_t file_type, uint32_t aux_type);
 
@@ -34,22 +43,57 @@ int set_file_type(const std::string &path, uint16_t file_type, uint32_t aux_type
 struct sym_info {
 	uint32_t segnum = 0;
 	uint32_t value = 0;
+	bool defined = false;
 };
 
-std::unordered_map<std::string, sym_info> symbol_table;
+// all symbol, section, group and file names.
+string_pool names;
 
+// indexed by name id.
+std::vector<sym_info> symbol_table;
 
-static std::vector<uint8_t> &append(std::vector<uint8_t> &v, const std::vector<uint8_t> &w) {
-	v.insert(v.end(), w.begin(), w.end());
-	return v;	
+// -l 4 statistics (relocation tokens referencing another section).
+struct pack_stats {
+	unsigned references = 0;
+	unsigned cut_before = 0; // packed by size (-l 3), for comparison
+	unsigned cut_after = 0;
+} packing;
+
+// -p (sn_section::heat is set.)
+bool profiled = false;
+
+static sym_info &find_symbol(unsigned name_id) {
+	if (symbol_table.size() <= name_id) symbol_table.resize(names.size());
+	return symbol_table[name_id];
 }
 
+
 template<class InputIt>
 static std::vector<uint8_t> &append(std::vector<uint8_t> &v, InputIt first, InputIt last) {
 	v.insert(v.end(), first, last);
 	return v;
 }
 
+static std::vector<uint8_t> &append(std::vector<uint8_t> &v, const std::pmr::vector<sn_data> &w) {
+	for (const auto &d : w) {
+		if (d.data) append(v, d.data, d.data + d.size);
+		else v.resize(v.size() + d.size, 0x00);
+	}
+	return v;
+}
+
+// apply constant relocations to section data that starts at offset.
+static void patch(std::vector<uint8_t> &v, uint32_t offset, const std::pmr::vector<sn_patch> &patches) {
+	for (const auto &p : patches) {
+		uint32_t address = offset + p.address;
+		uint32_t value = p.value;
+		for (unsigned i = 0; i < p.size; ++i) {
+			v[address + i] = value & 0xff;
+			value >>= 8;
+		}
+	}
+}
+
 #if 0
 template<class Input, class UnaryPredicate>
 Input::iterator find_if(Input &&input, UnaryPredicate p) {
@@ -79,7 +123,7 @@ static bool parse_number(const char *begin, const char *end, uint32_t &value, in
 
 int usage(int rv) {
 	fputs(
-		"snlink [-v1XCS] [-o outputfile] [-t type] [-D name=value] [-l 0|1|2] file.obj ...\n"
+		"snlink [-v1XCS] [-o outputfile] [-t type] [-D name=value] [-l 0|1|2|3|4] [-j jobs] [-c cachedir] [-r mode] [-g] [-u symbol] [-i] [-I section] [-m] [-p profile] file.obj ...\n"
 		"       -v: be verbose\n"
 		"       -o: specify output file\n"
 		"       -t: specify output file type\n"
@@ -88,7 +132,18 @@ int usage(int rv) {
 		"       -C: Inhibit OMF Compression\n"
 		"       -S: Inhibit OMF Super Records\n"
 		"       -D: define an equate\n"
-		"       -l: link type\n"
+		"       -l: link type (3 = pack sections into 64K segments, 4 = by references)\n"
+		"       -j: parse object files in parallel (0 = 1 per cpu)\n"
+		"       -c: cache parsed object files in cachedir\n"
+		"       -r: read ahead object files with none, fadvise, or uring\n"
+		"       -g: remove sections which aren't referenced from the entry point\n"
+		"       -u: keep the section defining symbol (with -g)\n"
+		"       -i: fold identical read-only sections (.code, .text, .rodata, .const)\n"
+		"       -I: also fold sections named section (with -i)\n"
+		"       -m: merge duplicate strings in .str sections\n"
+		"       -p: order sections by an execution profile\n"
+		"libraries (Psy-Q .LIB or sn-ar) only supply members which define an undefined symbol.\n"
+		"object files may be pipes; - is stdin.\n"
 
 		, stdout
 	);
@@ -165,7 +220,8 @@ static void add_define(std::string str) {
 		str.resize(ix-1);
 	}
 
-	symbol_table.emplace(str, sym_info{ 0, value });
+	auto &si = find_symbol(names.intern(str));
+	if (!si.defined) si = sym_info{ 0, value, true };
 }
 
 
@@ -179,16 +235,18 @@ void print_symbols() {
 
 	std::vector<xsym_info> table;
 
-	if (symbol_table.empty()) return;
-
-
 	int len = 0;
-	table.reserve(symbol_table.size());
-	for (const auto &kv : symbol_table) {
-		table.emplace_back(xsym_info{kv.first, kv.second.segnum, kv.second.value});
+	for (unsigned id = 0; id < symbol_table.size(); ++id) {
+		const auto &si = symbol_table[id];
+		if (!si.defined) continue;
 
-		len = std::max(len, (int)kv.first.length());		
+		const auto &name = names[id];
+		table.emplace_back(xsym_info{name, si.segnum, si.value});
+
+		len = std::max(len, (int)name.length());
 	}
+	if (table.empty()) return;
+
 	// also include local symbols?
 
 	// alpha-sort
@@ -230,90 +288,513 @@ void print_segments(std::vector<omf::segment> &segments) {
 	}
 }
 
-std::vector<std::string> collect_groups(std::vector<sn_unit> &units) {
+// assign name ids for everything the linker compares by name.
+void intern_names(sn_unit &u) {
+	for (auto &x : u.groups) x.name_id = names.intern(x.name);
+	for (auto &x : u.sections) x.name_id = names.intern(x.name);
+	for (auto &x : u.files) x.name_id = names.intern(x.name);
+	for (auto &x : u.globals) x.name_id = names.intern(x.name);
+	for (auto &x : u.externs) x.name_id = names.intern(x.name);
+}
+
+/*
+ * sections bucketed by (group, section name), in first-seen order.
+ * groups and sections are identified by their index (sn_section::layout_id
+ * is the section index + 1).  group 0 is the ungrouped sections.
+ */
+struct layout_group {
+	unsigned name_id = 0;
+	std::vector<unsigned> sections; // layout_section indices
+
+	// placement.  (not placed for -l 2, if it has multiple sections.)
+	bool placed = false;
+	unsigned segnum = 0;
+	uint32_t start = 0;
+	uint32_t end = 0;
+};
+
+struct layout_section {
+	unsigned name_id = 0;
+	std::vector<sn_section *> members; // in unit order
+
+	// placement.  (not placed for -l 3, if its members were split up.)
+	bool placed = false;
+	unsigned segnum = 0;
+	uint32_t start = 0;
+	uint32_t end = 0;
+};
+
+struct layout {
+	std::vector<layout_group> groups;
+	std::vector<layout_section> sections;
+	std::vector<int> group_map; // group name id -> group index
+};
+
+// one pass over every unit.
+static layout layout_sections(std::vector<sn_unit> &units) {
+
+	layout rv;
+
+	// (group index, section name id) -> section index.
+	std::unordered_map<uint64_t, unsigned> section_map;
 
-	std::vector<std::string> rv;
+	rv.group_map.resize(names.size(), -1);
+	rv.groups.emplace_back();
+	rv.group_map[0] = 0;
 
-	// check for empty...
-	bool has_empty = false;
 	for (auto &u : units) {
+
+		for (auto &g : u.groups) {
+			if (rv.group_map[g.name_id] >= 0) continue;
+			rv.group_map[g.name_id] = rv.groups.size();
+			rv.groups.emplace_back().name_id = g.name_id;
+		}
+
 		for (auto &s : u.sections) {
-			if (s.group_id) continue;
-			rv.emplace_back();
-			has_empty = true;
-			break;
+			if (s.folded) continue;
+
+			unsigned group = 0;
+			if (s.group_id) {
+				auto g = u.find_group(s.group_id);
+				if (!g) continue;
+				group = rv.group_map[g->name_id];
+			}
+
+			uint64_t k = ((uint64_t)group << 32) | s.name_id;
+			auto iter = section_map.find(k);
+			if (iter == section_map.end()) {
+				iter = section_map.emplace(k, rv.sections.size()).first;
+				rv.sections.emplace_back().name_id = s.name_id;
+				rv.groups[group].sections.push_back(iter->second);
+			}
+			rv.sections[iter->second].members.push_back(&s);
+			s.layout_id = iter->second + 1;
 		}
-		if (has_empty) break;
 	}
 
-	for (auto &u : units) {
-		for (auto &g : u.groups) {
-			if (std::find(rv.begin(), rv.end(), g.name) == rv.end())
-				rv.emplace_back(g.name);
+	return rv;
+}
+
+
+unsigned kind_for_name(const std::string &name) {
+	if (name == ".stack") return 0x0012; // static, public dp/stack segment
+
+	if (name == ".init") return 0x0010; // static, public, init segment
+
+	return 0; // static, public, code.
+}
+
+static void place(omf::segment &seg, sn_section &s) {
+
+	s.segnum = seg.segnum;
+	s.offset = seg.data.size();
+
+	append(seg.data, s.data);
+	patch(seg.data, s.offset, s.patches);
+}
+
+/*
+ * link type 3: sections are packed into as few bank sized segments as
+ * possible (first fit, largest first).  a section bucket which fits in
+ * a bank is kept together; a larger one is split into its members.  a
+ * segment only holds sections of one kind (see kind_for_name).  within
+ * a segment, sections are in their usual order, so a group or bucket
+ * which lands in one segment is still contiguous.
+ *
+ * link type 4 splits every bucket and partitions the sections by their
+ * references instead (see partition.cpp), to minimize INTERSEG records.
+ */
+struct pack_item {
+	unsigned group = 0;
+	unsigned section = 0;
+	sn_section *member = nullptr; // or the whole bucket
+	uint32_t size = 0;
+	unsigned kind = 0;
+	uint64_t heat = 0;
+};
+
+// returns the bin of each item.
+static std::vector<unsigned> first_fit(const std::vector<pack_item> &items, uint32_t capacity) {
+
+	struct bin {
+		unsigned kind = 0;
+		uint32_t size = 0;
+	};
+	std::vector<bin> bins;
+	std::vector<unsigned> rv(items.size());
+
+	std::vector<unsigned> order(items.size());
+	for (unsigned i = 0; i < order.size(); ++i) order[i] = i;
+	std::stable_sort(order.begin(), order.end(), [&](unsigned a, unsigned b){
+		return items[a].size > items[b].size;
+	});
+
+	for (auto i : order) {
+		const auto &it = items[i];
+		auto iter = std::find_if(bins.begin(), bins.end(), [&](const bin &b){
+			return b.kind == it.kind && b.size + it.size <= capacity;
+		});
+		if (iter == bins.end()) {
+			bins.emplace_back().kind = it.kind;
+			iter = bins.end() - 1;
 		}
+		iter->size += it.size;
+		rv[i] = iter - bins.begin();
 	}
 	return rv;
 }
 
-std::vector<std::string> collect_sections(std::vector<sn_unit> &units, const std::string &group_name) {
+// item references (one per relocation token), for partitioning.
+static std::vector<std::pair<unsigned, unsigned>> item_references(std::vector<sn_unit> &units, const std::vector<pack_item> &items) {
 
-	std::vector<std::string> rv;
+	std::unordered_map<const sn_section *, unsigned> item_map;
+	for (unsigned i = 0; i < items.size(); ++i)
+		item_map.emplace(items[i].member, i);
 
+	auto find_item = [&](const sn_section *s) -> int {
+		while (s->folded) s = s->folded;
+		auto iter = item_map.find(s);
+		return iter == item_map.end() ? -1 : (int)iter->second;
+	};
+
+	// global name id -> item.
+	std::vector<int> defined(names.size(), -1);
 	for (auto &u : units) {
-		unsigned group_id = 0;
-		if (!group_name.empty()) {
-			auto g = u.find_group(group_name);
-			if (!g) continue;
-			group_id = g->group_id;
+		for (const auto &sym : u.globals) {
+			if (!sym.section_id || defined[sym.name_id] >= 0) continue;
+			if (auto ss = u.find_section(sym.section_id)) defined[sym.name_id] = find_item(ss);
 		}
+	}
 
+	std::vector<std::pair<unsigned, unsigned>> rv;
+	for (auto &u : units) {
 		for (auto &s : u.sections) {
-			if (s.group_id != group_id) continue;
-			if (std::find(rv.begin(), rv.end(), s.name) == rv.end())
-				rv.emplace_back(s.name);
+			if (s.relocs.empty()) continue;
+			int from = find_item(&s);
+			if (from < 0) continue;
+
+			for (const auto &r : s.relocs) {
+				for (const auto &e : u.expr(r)) {
+					int to = -1;
+					if (e.op == V_SECTION) {
+						if (auto ss = u.find_section(e.value)) to = find_item(ss);
+					}
+					if (e.op == V_EXTERN) {
+						if (auto ee = u.find_extern(e.value)) to = defined[ee->name_id];
+					}
+					if (to >= 0) rv.emplace_back(from, to);
+				}
+			}
 		}
 	}
 	return rv;
 }
 
-template<>
-struct std::hash< std::pair<std::string, std::string> > {
-	std::size_t operator()(std::pair<std::string, std::string> const &s ) const noexcept {
-		auto s1 = std::hash<std::string>{}(s.first);
-		auto s2 = std::hash<std::string>{}(s.second);
-		return s1 ^ s2;
+static unsigned cut_size(const std::vector<std::pair<unsigned, unsigned>> &refs, const std::vector<unsigned> &bin) {
+	unsigned rv = 0;
+	for (auto [a, b] : refs) rv += bin[a] != bin[b];
+	return rv;
+}
+
+static void pack_sections(std::vector<sn_unit> &units, layout &lay, std::vector<omf::segment> &rv, int type) {
+
+	const uint32_t bank = 0x10000;
+
+	std::vector<pack_item> items;
+	for (unsigned g = 0; g < lay.groups.size(); ++g) {
+		const auto &group = lay.groups[g];
+		unsigned gkind = kind_for_name(names[group.name_id]);
+
+		for (auto index : group.sections) {
+			const auto &section = lay.sections[index];
+			unsigned kind = gkind ? gkind : kind_for_name(names[section.name_id]);
+
+			uint32_t size = 0;
+			uint64_t heat = 0;
+			for (auto sp : section.members) {
+				size += sp->size;
+				heat += sp->heat;
+			}
+
+			if (size <= bank && type == 3) {
+				items.push_back(pack_item{ g, index, nullptr, size, kind, heat });
+				continue;
+			}
+			for (auto sp : section.members) {
+				uint32_t size = sp->size;
+				if (size > bank) {
+					warnx("Section %s is larger than a bank ($%06x bytes)",
+						names[section.name_id].c_str(), size);
+				}
+				items.push_back(pack_item{ g, index, sp, size, kind, sp->heat });
+			}
+		}
 	}
-};
 
 
-unsigned kind_for_name(const std::string &name) {
-	if (name == ".stack") return 0x0012; // static, public dp/stack segment
+	std::vector<unsigned> assignment = first_fit(items, bank);
+	if (type == 4) {
+		auto refs = item_references(units, items);
 
-	if (name == ".init") return 0x0010; // static, public, init segment
+		std::vector<uint32_t> sizes;
+		std::vector<unsigned> kinds;
+		uint64_t max_heat = 0;
+		for (const auto &it : items) {
+			sizes.push_back(it.size);
+			kinds.push_back(it.kind);
+			max_heat = std::max(max_heat, it.heat);
+		}
 
-	return 0; // static, public, code.
+		// with a profile, a reference to a hot section counts for up to 64.
+		std::vector<unsigned> weights;
+		if (max_heat) {
+			for (auto [a, b] : refs) {
+				uint64_t heat = items[b].heat;
+				weights.push_back(heat ? 2 + heat * 62 / max_heat : 1);
+			}
+		}
+
+		packing.references = refs.size();
+		packing.cut_before = cut_size(refs, assignment);
+		assignment = partition_graph(sizes, kinds, refs, weights, bank);
+		packing.cut_after = cut_size(refs, assignment);
+	}
+
+	struct bin {
+		unsigned kind = 0;
+		std::vector<unsigned> items;
+	};
+	std::vector<bin> bins;
+	for (unsigned i = 0; i < items.size(); ++i) {
+		unsigned b = assignment[i];
+		if (b >= bins.size()) bins.resize(b + 1);
+		bins[b].kind = items[i].kind;
+		bins[b].items.push_back(i);
+	}
+	bins.erase(std::remove_if(bins.begin(), bins.end(), [](const bin &b){
+		return b.items.empty();
+	}), bins.end());
+
+	// segments in the order of their first section, which keeps the
+	// entry point in segment 1.  (items are already in order.)
+	std::sort(bins.begin(), bins.end(), [](const bin &a, const bin &b){
+		return a.items.front() < b.items.front();
+	});
+
+	// hot sections first (but the entry point stays first).
+	for (auto &b : bins) {
+		auto first = b.items.begin();
+		if (*first == 0) ++first;
+		std::stable_sort(first, b.items.end(), [&](unsigned x, unsigned y){
+			return items[x].heat > items[y].heat;
+		});
+	}
+
+
+	// a group or bucket is placed if it's contiguous, in one segment.
+	const unsigned none = -1;
+	std::vector<std::pair<unsigned, unsigned>> group_last(lay.groups.size(), { none, none });
+	std::vector<std::pair<unsigned, unsigned>> section_last(lay.sections.size(), { none, none });
+	std::vector<bool> group_split(lay.groups.size());
+	std::vector<bool> section_split(lay.sections.size());
+
+	for (unsigned b = 0; b < bins.size(); ++b) {
+		for (unsigned k = 0; k < bins[b].items.size(); ++k) {
+			const auto &it = items[bins[b].items[k]];
+			auto &gl = group_last[it.group];
+			auto &sl = section_last[it.section];
+			if (gl.first != none && (gl.first != b || gl.second != k - 1)) group_split[it.group] = true;
+			if (sl.first != none && (sl.first != b || sl.second != k - 1)) section_split[it.section] = true;
+			gl = { b, k };
+			sl = { b, k };
+		}
+	}
+
+	for (const auto &b : bins) {
+
+		auto &seg = rv.emplace_back();
+		seg.segnum = rv.size();
+		seg.kind = b.kind;
+
+		const auto &first = items[b.items.front()];
+		unsigned gname = lay.groups[first.group].name_id;
+		seg.segname = names[gname ? gname : lay.sections[first.section].name_id];
+
+		for (auto i : b.items) {
+			const auto &it = items[i];
+			auto &group = lay.groups[it.group];
+			auto &section = lay.sections[it.section];
+
+			if (!group_split[it.group] && !group.placed) {
+				group.placed = true;
+				group.segnum = seg.segnum;
+				group.start = seg.data.size();
+			}
+			if (!section_split[it.section] && !section.placed) {
+				section.placed = true;
+				section.segnum = seg.segnum;
+				section.start = seg.data.size();
+			}
+
+			if (it.member) {
+				place(seg, *it.member);
+			} else {
+				for (auto sp : section.members) place(seg, *sp);
+			}
+
+			if (group.placed) group.end = seg.data.size();
+			if (section.placed) section.end = seg.data.size();
+		}
+	}
 }
 
-// link types -
-// 0: 1 segment for everything
-// 1: 1 segment per group
-// 2: 1 segment per section (group/groupend might not work)
-std::vector<omf::segment> link_it(std::vector<sn_unit> &units, int type) {
+/*
+ * add the profile samples to the sections they hit.  segments is the
+ * layout without the profile, for location and address samples.
+ * returns the number of samples which didn't hit anything.
+ */
+static uint64_t apply_profile(std::vector<sn_unit> &units, const profile &p, const std::vector<omf::segment> &segments) {
+
+	auto root = [](sn_section *s){
+		while (s->folded) s = s->folded;
+		return s;
+	};
 
+	// global name id -> section.
+	std::unordered_map<unsigned, sn_section *> symbols;
+	// segment -> (offset, section), sorted.
+	std::vector<std::vector<std::pair<uint32_t, sn_section *>>> placed(segments.size() + 1);
 
-	typedef std::pair<std::string, std::string> key;
-	struct value {
-		unsigned segnum = 0;
-		uint32_t start = 0;
-		uint32_t end = 0;
+	for (auto &u : units) {
+		for (const auto &sym : u.globals) {
+			if (!sym.section_id) continue;
+			if (auto ss = u.find_section(sym.section_id))
+				symbols.emplace(sym.name_id, root(ss));
+		}
+		for (auto &s : u.sections) {
+			if (s.folded || !s.layout_id || s.segnum >= placed.size()) continue;
+			placed[s.segnum].emplace_back(s.offset, &s);
+		}
+	}
+	for (auto &v : placed) std::sort(v.begin(), v.end());
+
+	auto find_location = [&](unsigned segnum, uint32_t offset) -> sn_section * {
+		if (segnum == 0 || segnum >= placed.size()) return nullptr;
+		const auto &v = placed[segnum];
+		auto iter = std::upper_bound(v.begin(), v.end(), std::pair(offset, (sn_section *)UINTPTR_MAX));
+		if (iter == v.begin()) return nullptr;
+		--iter;
+		if (offset - iter->first >= iter->second->size) return nullptr;
+		return iter->second;
 	};
 
-	std::unordered_map<key, value> dict;
+	uint64_t missed = 0;
+	for (const auto &sample : p.samples) {
+		sn_section *s = nullptr;
+
+		switch (sample.type) {
+		case profile_sample::symbol: {
+			auto iter = symbols.find(names.find(sample.name));
+			if (iter != symbols.end()) s = iter->second;
+			break;
+		}
+		case profile_sample::location:
+			s = find_location(sample.segnum, sample.offset);
+			break;
+		case profile_sample::address:
+			for (auto [segnum, address] : p.loads) {
+				if (segnum == 0 || segnum > segments.size()) continue;
+				if (sample.offset - address < segments[segnum - 1].data.size()) {
+					s = find_location(segnum, sample.offset - address);
+					break;
+				}
+			}
+			break;
+		}
+
+		if (s) s->heat += sample.count;
+		else missed += sample.count;
+	}
+	return missed;
+}
+
+// hot bytes per segment, and how far apart they are.
+static void print_heat(const std::vector<sn_unit> &units, const std::vector<omf::segment> &segments, uint64_t samples, uint64_t missed) {
+
+	struct info {
+		uint32_t bytes = 0;
+		uint32_t first = UINT32_MAX;
+		uint32_t last = 0;
+	};
+	std::vector<info> hot(segments.size() + 1);
+
+	for (const auto &u : units) {
+		for (const auto &s : u.sections) {
+			if (!s.heat || s.folded || s.segnum >= hot.size()) continue;
+			uint32_t size = s.size;
+			auto &h = hot[s.segnum];
+			h.bytes += size;
+			h.first = std::min(h.first, s.offset);
+			h.last = std::max(h.last, s.offset + size);
+		}
+	}
+
+	printf("Profile: %llu samples, %llu not in any section\n",
+		(unsigned long long)samples, (unsigned long long)missed);
+	for (const auto &seg : segments) {
+		const auto &h = hot[seg.segnum];
+		if (!h.bytes) continue;
+		printf("Hot: %u (%-12s): $%06x of $%06x bytes, in $%06x\n",
+			seg.segnum, seg.segname.c_str(), h.bytes, (uint32_t)seg.data.size(), h.last - h.first);
+	}
+}
+
+/*
+ * profile (-p) ordering for link types 0-2: hot sections first within
+ * their bucket, and hot buckets first within their group.  the first
+ * section (the entry point) stays first.
+ */
+static void order_by_heat(layout &lay) {
+
+	std::vector<uint64_t> heat(lay.sections.size());
+	bool entry = true;
+
+	for (auto &group : lay.groups) {
+		if (group.sections.empty()) continue;
+
+		for (unsigned k = 0; k < group.sections.size(); ++k) {
+			unsigned index = group.sections[k];
+			auto &members = lay.sections[index].members;
+			for (auto sp : members) heat[index] += sp->heat;
+
+			auto first = members.begin();
+			if (entry && k == 0 && first != members.end()) ++first;
+			std::stable_sort(first, members.end(), [](const sn_section *a, const sn_section *b){
+				return a->heat > b->heat;
+			});
+		}
+
+		auto first = group.sections.begin() + (entry ? 1 : 0);
+		std::stable_sort(first, group.sections.end(), [&](unsigned a, unsigned b){
+			return heat[a] > heat[b];
+		});
+		entry = false;
+	}
+}
+
+// link types -
+// 0: 1 segment for everything
+// 1: 1 segment per group
+// 2: 1 segment per section (group/groupend might not work)
+// 3: sections packed into 64K segments (group/sect might not work)
+// 4: sections partitioned into 64K segments by references (ditto)
+// layout_only places the sections (segnum/offset) and stops.
+std::vector<omf::segment> link_it(std::vector<sn_unit> &units, int type, bool layout_only = false) {
 
 
 	std::vector<omf::segment> rv;
 
-	omf::segment * seg;
+	omf::segment *seg = nullptr;
 	if (type == 0) {
 		// 1 segment
 		seg = &rv.emplace_back();
@@ -321,78 +802,82 @@ std::vector<omf::segment> link_it(std::vector<sn_unit> &units, int type) {
 	}
 
 
-	auto groups = collect_groups(units);
-	for (auto gname : groups) {
+	auto lay = layout_sections(units);
+	if (type < 3 && profiled) order_by_heat(lay);
+	if (type >= 3) pack_sections(units, lay, rv, type);
+	else for (auto &group : lay.groups) {
 
-		auto sections = collect_sections(units, gname);
+		// the ungrouped sections only get a segment if there are any.
+		if (&group == &lay.groups.front() && group.sections.empty())
+			continue;
+
+		unsigned gname = group.name_id;
 
 		if (type == 1) {
 			// 1 segment per group
 			seg = &rv.emplace_back();
 			seg->segnum = rv.size();
-			seg->segname = gname;
-			seg->kind = kind_for_name(gname);
+			seg->segname = names[gname];
+			seg->kind = kind_for_name(names[gname]);
 		}
 
+		// (type 2 starts a new segment for each section.)
+		uint32_t group_offset = type == 2 ? 0 : seg->data.size();
 
-		uint32_t group_offset = seg->data.size();
-
-		for (auto &sname : sections) {
+		for (auto index : group.sections) {
 
+			auto &section = lay.sections[index];
+			unsigned sname = section.name_id;
 
 			if (type == 2) {
 				// 1 section per segment.
 				seg = &rv.emplace_back();
 				seg->segnum = rv.size();
-				seg->segname = sname;
-				seg->kind = kind_for_name(sname);
-		}
-
-			uint32_t section_offset = seg->data.size();
-
-			for (auto &u : units) {
+				seg->segname = names[sname];
+				seg->kind = kind_for_name(names[sname]);
+			}
 
-				unsigned group_id = 0;
-				if (!gname.empty()) {
-					auto gg = u.find_group(gname);
-					if (!gg) continue;
-					group_id = gg->group_id;
-				}
+			section.placed = true;
+			section.segnum = seg->segnum;
+			section.start = seg->data.size();
 
+			for (auto sp : section.members)
+				place(*seg, *sp);
 
-				for (auto &s : u.sections) {
-					if (s.group_id != group_id) continue;
-					if (s.name != sname) continue;
+			section.end = seg->data.size();
+		}
 
-					s.segnum = seg->segnum;
-					s.offset = seg->data.size();
+		// type 2 can't do group/groupend() ... unless it's 1-section
+		if (type != 2 || group.sections.size() == 1) {
+			group.placed = true;
+			group.segnum = seg->segnum;
+			group.start = group_offset;
+			group.end = seg->data.size();
+		}
+	}
 
-					append(seg->data, s.data);
+	if (layout_only) return rv;
 
-					// also update the relocations...
-					for (auto &r : s.relocs) {
-						r.address += s.offset;
-					}
-				}
+	// also update the relocations...
+	for (auto &u : units) {
+		for (auto &s : u.sections) {
+			if (s.folded || !s.layout_id) continue;
+			for (auto &r : s.relocs) {
+				r.address += s.offset;
 			}
-
-
-			auto k = std::make_pair(gname, sname);
-			auto v = value { seg->segnum, section_offset, (uint32_t)seg->data.size() };
-
-			dict.emplace(k, v);
 		}
+	}
 
-		// type 2 can't do group/groupend() ... unless it's 1-section
-		if (type == 2 && sections.size() == 1) {
-			auto k = std::make_pair(gname, "");
-			auto v = value { seg->segnum, 0, (uint32_t)seg->data.size() };
-			dict.emplace(k, v);			
-		}
-		if (type != 2) {
-			auto k = std::make_pair(gname, "");
-			auto v = value { seg->segnum, group_offset, (uint32_t)seg->data.size() };
-			dict.emplace(k, v);
+	// folded sections are placed wherever their copy was.
+	for (auto &u : units) {
+		for (auto &s : u.sections) {
+			if (!s.folded) continue;
+			// (a merged string section may itself have been folded.)
+			auto f = s.folded;
+			while (f->folded) f = f->folded;
+			s.segnum = f->segnum;
+			s.offset = f->offset;
+			s.layout_id = f->layout_id;
 		}
 	}
 
@@ -402,7 +887,7 @@ std::vector<omf::segment> link_it(std::vector<sn_unit> &units, int type) {
 	for (auto &u : units) {
 		for (auto &s : u.sections) {
 			for (auto &r : s.relocs) {
-				for (auto &e : r.expr) {
+				for (auto &e : u.expr(r)) {
 					if (e.op == V_SECTION) {
 						// internal section reference.
 
@@ -410,7 +895,7 @@ std::vector<omf::segment> link_it(std::vector<sn_unit> &units, int type) {
 
 						if (!ss) {
 							errx(1, "%s: %s: Unable to find section %u",
-								u.filename.c_str(), s.name.c_str(), e.value
+								u.filename.c_str(), names[s.name_id].c_str(), e.value
 							);
 						}
 
@@ -422,55 +907,43 @@ std::vector<omf::segment> link_it(std::vector<sn_unit> &units, int type) {
 						auto ss = u.find_section(e.value);
 						if (!ss) {
 							errx(1, "%s: %s: Unable to find section %u",
-								u.filename.c_str(), s.name.c_str(), e.value
+								u.filename.c_str(), names[s.name_id].c_str(), e.value
 							);
 						}
-
-						auto gg = ss->group_id ? u.find_group(ss->group_id) : nullptr;
-						if (ss->group_id && !gg) {
-							errx(1, "%s: %s: Unable to find group %s",
-								u.filename.c_str(), s.name.c_str(), gg->name.c_str()
-							);				
+						if (!ss->layout_id) {
+							errx(1, "%s: %s: Unable to find group %u",
+								u.filename.c_str(), names[s.name_id].c_str(), ss->group_id
+							);
 						}
 
-						auto k = std::make_pair(gg ? gg->name : "", ss->name);
-						auto iter = dict.find(k);
-						if (iter == dict.end()) {
-							errx(1, "%s: %s: Unable to find %s:%s",
-								u.filename.c_str(), s.name.c_str(), gg->name.c_str(), s.name.c_str()
+						const auto &v = lay.sections[ss->layout_id - 1];
+						if (!v.placed) {
+							errx(1, "%s: %s: Unable to find section %s",
+								u.filename.c_str(), names[s.name_id].c_str(), names[v.name_id].c_str()
 							);
 						}
-						const auto &v = iter->second;
-						e.op = (v.segnum << 8) | V_OMF;
 						e.value = e.op == V_FN_SECT ? v.start : v.end;
+						e.op = (v.segnum << 8) | V_OMF;
 						continue;
 					}
 
 					if (e.op == V_FN_GROUP || e.op == V_FN_GROUP_END) {
 
-						#if 0
-						if (type == 2) {
-							errx(1, "group() and groupend() not supported with section-based segments")
-						}
-						#endif
-
 						auto gg = u.find_group(e.value);
 						if (!gg) {
 							errx(1, "%s: %s: Unable to find group %u",
-								u.filename.c_str(), s.name.c_str(), e.value
+								u.filename.c_str(), names[s.name_id].c_str(), e.value
 							);
 						}
 
-						auto k = std::make_pair(gg->name, std::string());
-						auto iter = dict.find(k);
-						if (iter == dict.end()) {
+						const auto &v = lay.groups[lay.group_map[gg->name_id]];
+						if (!v.placed) {
 							errx(1, "%s: %s: Unable to find group %s",
-								u.filename.c_str(), s.name.c_str(), gg->name.c_str()
+								u.filename.c_str(), names[s.name_id].c_str(), names[gg->name_id].c_str()
 							);
 						}
-						const auto &v = iter->second;
-						e.op = (v.segnum << 8) | V_OMF;
 						e.value = e.op == V_FN_GROUP ? v.start : v.end;
+						e.op = (v.segnum << 8) | V_OMF;
 						continue;
 					}
 				}
@@ -482,6 +955,298 @@ std::vector<omf::segment> link_it(std::vector<sn_unit> &units, int type) {
 	return rv;
 }
 
+// -c cache directory (empty = no cache), and its statistics for -v.
+std::string cache_dir;
+std::atomic<unsigned> cache_hits{0};
+std::atomic<unsigned> cache_misses{0};
+
+// parse one object file, through the cache if there is one.  thread safe.
+static bool load_unit(const std::string &path, sn_unit &unit, std::string &error) {
+
+	if (cache_dir.empty())
+		return sn_parse_unit(path, unit, error);
+
+	if (sn_cache_load(cache_dir, path, unit)) {
+		cache_hits++;
+		return true;
+	}
+
+	cache_misses++;
+	if (!sn_parse_unit(path, unit, error)) return false;
+	sn_cache_save(cache_dir, unit);
+	return true;
+}
+
+/*
+ * parse the object files with up to `jobs` threads.  units are stored
+ * by argument index so the order (and output) matches the serial version.
+ * if anything fails, the error for the first failing file is reported.
+ */
+void parse_units(std::vector<sn_unit> &units, int argc, char **argv, unsigned jobs, readahead &ra) {
+
+	// how many files to read ahead of the one being parsed.
+	constexpr int ahead = 8;
+
+	units.resize(argc);
+
+	if (jobs == 0) jobs = std::thread::hardware_concurrency();
+	if (jobs > (unsigned)argc) jobs = argc;
+
+	for (int i = 0; i < std::min(ahead, argc); ++i)
+		ra.hint(argv[i]);
+
+	if (jobs <= 1) {
+		for (int i = 0; i < argc; ++i) {
+			std::string error;
+			if (i + ahead < argc) ra.hint(argv[i + ahead]);
+			if (!load_unit(argv[i], units[i], error))
+				errx(1, "%s", error.c_str());
+		}
+		return;
+	}
+
+	std::vector<std::string> errors(argc);
+	std::vector<std::thread> threads;
+	std::atomic<int> next{0};
+
+	auto worker = [&](){
+		for(;;) {
+			int i = next++;
+			if (i >= argc) break;
+			if (i + ahead < argc) ra.hint(argv[i + ahead]);
+			load_unit(argv[i], units[i], errors[i]);
+		}
+	};
+
+	threads.reserve(jobs);
+	for (unsigned i = 0; i < jobs; ++i)
+		threads.emplace_back(worker);
+	for (auto &t : threads)
+		t.join();
+
+	for (const auto &e : errors) {
+		if (!e.empty()) errx(1, "%s", e.c_str());
+	}
+}
+
+/*
+ * section garbage collection.  roots are the first section (the entry
+ * point), .init and .stack sections or groups, and the sections defining
+ * the -u symbols.  a section keeps everything its relocations reference
+ * (sections, externs, and group()/sect() functions).  everything else --
+ * and any symbols it defines -- is removed before layout.
+ */
+struct gc_stats {
+	unsigned sections = 0;
+	unsigned removed = 0;
+	uint32_t bytes = 0;
+};
+
+static gc_stats gc_sections(std::vector<sn_unit> &units, const std::vector<std::string> &roots) {
+
+	typedef std::pair<unsigned, unsigned> ref; // unit index, section index
+
+	gc_stats rv;
+
+	std::vector<std::vector<bool>> live(units.size());
+	std::vector<ref> work;
+
+	auto mark = [&](unsigned unit, unsigned section){
+		if (live[unit][section]) return;
+		live[unit][section] = true;
+		work.emplace_back(unit, section);
+	};
+
+	auto group_name = [](sn_unit &u, const sn_section &s) -> unsigned {
+		if (!s.group_id) return 0;
+		auto g = u.find_group(s.group_id);
+		return g ? g->name_id : 0;
+	};
+
+	// global name id -> defining section.  the first definition wins.
+	std::vector<ref> definitions(names.size(), ref(-1, -1));
+	// group name id -> sections.
+	std::vector<std::vector<ref>> groups(names.size());
+
+	for (unsigned i = 0; i < units.size(); ++i) {
+		auto &u = units[i];
+		live[i].resize(u.sections.size());
+		rv.sections += u.sections.size();
+
+		for (const auto &sym : u.globals) {
+			if (!sym.section_id || definitions[sym.name_id].first != -1u) continue;
+			auto ss = u.find_section(sym.section_id);
+			if (ss) definitions[sym.name_id] = ref(i, ss - u.sections.data());
+		}
+		for (unsigned j = 0; j < u.sections.size(); ++j) {
+			const auto &s = u.sections[j];
+			unsigned g = group_name(u, s);
+			if (g) groups[g].emplace_back(i, j);
+		}
+	}
+
+
+	// roots.  the entry is the first section layout_sections places -- the
+	// first ungrouped section, if there are any, or else the first section
+	// of the first group (in declaration order) which isn't empty.
+	ref entry(-1, -1);
+	for (unsigned i = 0; i < units.size() && entry.first == -1u; ++i) {
+		auto &u = units[i];
+		for (unsigned j = 0; j < u.sections.size(); ++j) {
+			if (!u.sections[j].group_id) {
+				entry = ref(i, j);
+				break;
+			}
+		}
+	}
+	for (unsigned i = 0; i < units.size() && entry.first == -1u; ++i) {
+		for (const auto &g : units[i].groups) {
+			if (!groups[g.name_id].empty()) {
+				entry = groups[g.name_id].front();
+				break;
+			}
+		}
+	}
+	if (entry.first != -1u) mark(entry.first, entry.second);
+
+	unsigned init = names.find(".init");
+	unsigned stack = names.find(".stack");
+	for (unsigned i = 0; i < units.size(); ++i) {
+		auto &u = units[i];
+		for (unsigned j = 0; j < u.sections.size(); ++j) {
+			const auto &s = u.sections[j];
+			unsigned g = group_name(u, s);
+			if ((init && (s.name_id == init || g == init)) || (stack && (s.name_id == stack || g == stack)))
+				mark(i, j);
+		}
+	}
+
+	for (const auto &name : roots) {
+		unsigned id = names.find(name);
+		if (!id || definitions[id].first == -1u) {
+			warnx("Undefined root symbol %s", name.c_str());
+			continue;
+		}
+		mark(definitions[id].first, definitions[id].second);
+	}
+
+
+	while (!work.empty()) {
+		auto [i, j] = work.back();
+		work.pop_back();
+
+		auto &u = units[i];
+		const auto &s = u.sections[j];
+		for (const auto &r : s.relocs) {
+			for (const auto &e : u.expr(r)) {
+				switch (e.op) {
+				case V_SECTION:
+				case V_FN_SECT:
+				case V_FN_SECT_END:
+					if (auto ss = u.find_section(e.value))
+						mark(i, ss - u.sections.data());
+					break;
+
+				case V_EXTERN:
+					if (auto ee = u.find_extern(e.value)) {
+						const auto &d = definitions[ee->name_id];
+						if (d.first != -1u) mark(d.first, d.second);
+					}
+					break;
+
+				case V_FN_GROUP:
+				case V_FN_GROUP_END:
+					if (auto gg = u.find_group(e.value)) {
+						for (const auto &d : groups[gg->name_id])
+							mark(d.first, d.second);
+					}
+					break;
+				}
+			}
+		}
+	}
+
+
+	// remove the dead sections and their symbols.
+	for (unsigned i = 0; i < units.size(); ++i) {
+		auto &u = units[i];
+		const auto &l = live[i];
+
+		if (std::find(l.begin(), l.end(), false) == l.end()) continue;
+
+		// (symbols first, while the section index is still valid.)
+		auto dead_symbol = [&](const sn_symbol &sym){
+			if (!sym.section_id) return false;
+			auto ss = u.find_section(sym.section_id);
+			return ss && !l[ss - u.sections.data()];
+		};
+		u.globals.erase(std::remove_if(u.globals.begin(), u.globals.end(), dead_symbol), u.globals.end());
+		u.locals.erase(std::remove_if(u.locals.begin(), u.locals.end(), dead_symbol), u.locals.end());
+
+		unsigned k = 0;
+		for (unsigned j = 0; j < u.sections.size(); ++j) {
+			if (!l[j]) {
+				rv.removed++;
+				rv.bytes += u.sections[j].size;
+				continue;
+			}
+			if (k != j) u.sections[k] = std::move(u.sections[j]);
+			++k;
+		}
+		u.sections.erase(u.sections.begin() + k, u.sections.end());
+		u.build_indexes();
+	}
+
+	return rv;
+}
+
+/*
+ * pull in library members that define an undefined extern.  members can
+ * have externs of their own, so this continues until nothing changes.
+ * the libraries are searched in command line order.
+ */
+static unsigned pull_members(std::vector<sn_unit> &units, std::vector<sn_library> &libraries) {
+
+	unsigned count = 0;
+
+	// by name id.  -D symbols are already in the symbol table.
+	std::vector<bool> defined(names.size());
+	for (unsigned id = 0; id < symbol_table.size(); ++id) {
+		if (symbol_table[id].defined) defined[id] = true;
+	}
+
+	auto define = [&](const sn_unit &u){
+		defined.resize(names.size());
+		for (const auto &sym : u.globals)
+			defined[sym.name_id] = true;
+	};
+
+	for (const auto &u : units) define(u);
+
+	// (units grows as members are loaded, so no references are held.)
+	for (size_t i = 0; i < units.size(); ++i) {
+		for (size_t j = 0; j < units[i].externs.size(); ++j) {
+			unsigned name_id = units[i].externs[j].name_id;
+			if (defined[name_id]) continue;
+
+			for (auto &lib : libraries) {
+				int m = lib.find(names[name_id]);
+				if (m < 0 || lib.members[m].loaded) continue;
+
+				std::string error;
+				auto &u = units.emplace_back();
+				if (!lib.load(m, u, error))
+					errx(1, "%s", error.c_str());
+				intern_names(u);
+				define(u);
+				++count;
+				break;
+			}
+		}
+	}
+	return count;
+}
+
 int main(int argc, char **argv) {
 
 	std::vector<sn_unit> units;
@@ -494,11 +1259,19 @@ int main(int argc, char **argv) {
 	unsigned file_type = 0xb3;
 	unsigned aux_type = 0;
 	unsigned link_type = 1;
+	uint32_t jobs = 1;
+	auto readahead_mode = readahead::none;
+	bool gc = false;
+	bool icf = false;
+	bool merge = false;
+	std::string profile_path;
+	std::vector<std::string> roots;
+	std::vector<std::string> readonly;
 
 	unsigned omf_flags = OMF_V2;
 	bool verbose = false;
 
-	while ((ch = getopt(argc, argv, "o:D:t:vhX1CSl:")) != -1) {
+	while ((ch = getopt(argc, argv, "o:D:t:vhX1CSl:j:c:r:gu:iI:mp:")) != -1) {
 		switch(ch) {
 		case 'v': verbose = true; break;
 		case 'o': outfile = optarg; break;
@@ -513,11 +1286,26 @@ int main(int argc, char **argv) {
 			}
 			break;
 		case 'l': 
-			if (*optarg >= '0' && *optarg <= '2')
+			if (*optarg >= '0' && *optarg <= '4')
 				link_type = *optarg - '0';
 			else
 				errx(1, "Bad link type: %s", optarg);
 			break;
+		case 'j':
+			if (!parse_number(optarg, optarg + strlen(optarg), jobs))
+				errx(1, "Bad job count: %s", optarg);
+			break;
+		case 'c': cache_dir = optarg; break;
+		case 'r':
+			if (!readahead::parse_mode(optarg, readahead_mode))
+				errx(1, "Bad read-ahead mode: %s", optarg);
+			break;
+		case 'g': gc = true; break;
+		case 'i': icf = true; break;
+		case 'I': readonly.emplace_back(optarg); break;
+		case 'm': merge = true; break;
+		case 'p': profile_path = optarg; break;
+		case 'u': roots.emplace_back(optarg); break;
 		case 'D':
 			// -D key=value
 			add_define(optarg);
@@ -532,14 +1320,59 @@ int main(int argc, char **argv) {
 	if (argc == 0) usage(0);
 
 
-	// load all the files...
+	// libraries are only searched once all the object files are loaded.
+	std::vector<char *> objects;
+	std::vector<sn_library> libraries;
 	for (int i = 0; i < argc; ++i) {
-		std::string path(argv[i]);
+		if (!sn_is_library(argv[i])) {
+			objects.push_back(argv[i]);
+			continue;
+		}
+		std::string error;
+		if (!sn_open_library(argv[i], libraries.emplace_back(), error))
+			errx(1, "%s", error.c_str());
+	}
 
-		auto &unit = units.emplace_back();
-		sn_parse_unit(path, unit);
+	// load all the files...
+	readahead ra(readahead_mode);
+	parse_units(units, objects.size(), objects.data(), jobs, ra);
+
+	for (auto &u : units)
+		intern_names(u);
+
+	unsigned members = 0;
+	if (!libraries.empty())
+		members = pull_members(units, libraries);
+
+	gc_stats gs;
+	if (gc) gs = gc_sections(units, roots);
+
+	unsigned merged = 0;
+	uint32_t merged_bytes = 0;
+	if (merge) merged = merge_strings(units, merged_bytes);
+
+	unsigned folded = 0;
+	uint32_t folded_bytes = 0;
+	if (icf) folded = fold_sections(units, jobs, readonly, folded_bytes);
+
+	// the profile may need the layout without it.
+	uint64_t samples = 0;
+	uint64_t missed = 0;
+	if (!profile_path.empty()) {
+		profile prof;
+		std::string error;
+		if (!read_profile(profile_path, prof, error))
+			errx(1, "%s", error.c_str());
+
+		std::vector<omf::segment> unprofiled;
+		if (prof.needs_layout()) unprofiled = link_it(units, link_type, true);
+		missed = apply_profile(units, prof, unprofiled);
+		for (const auto &s : prof.samples) samples += s.count;
+		profiled = true;
 	}
 
+	symbol_table.resize(names.size());
+
 	// merge into omf segments.
 	segments = link_it(units, link_type);
 
@@ -547,17 +1380,17 @@ int main(int argc, char **argv) {
 	for (auto &u : units) {
 
 		for (const auto &sym : u.globals) {
-			const auto &name = sym.name;
-			auto dupe_iter = symbol_table.find(name);
-			auto dupe = dupe_iter != symbol_table.end();
+			const auto &name = names[sym.name_id];
+			auto &si = symbol_table[sym.name_id];
+			auto dupe = si.defined;
 			// duplicate constants are ok...
 			if (!sym.section_id) {
 
 				if (!dupe) {
-					symbol_table.emplace(name, sym_info{0, sym.value });
+					si = sym_info{0, sym.value, true };
 					continue;
 				}
-				const auto &other = dupe_iter->second;
+				const auto &other = si;
 				if (other.segnum == 0 && other.value == sym.value)
 					continue;
 			}
@@ -576,7 +1409,7 @@ int main(int argc, char **argv) {
 				);
 			}
 
-			symbol_table.emplace(name, sym_info{ ss->segnum, ss->offset + sym.value });
+			si = sym_info{ ss->segnum, ss->offset + sym.value, true };
 		}
 	}
 
@@ -584,7 +1417,7 @@ int main(int argc, char **argv) {
 	for (auto &u : units) {
 		for (auto &s : u.sections) {
 			for (auto &r : s.relocs) {
-				for (auto &e : r.expr) {
+				for (auto &e : u.expr(r)) {
 					if (e.op == V_EXTERN) {
 						// extern symbol.
 
@@ -592,17 +1425,16 @@ int main(int argc, char **argv) {
 
 						if (!ee) {
 							errx(1, "%s: %s: Unable to find symbol %u",
-								u.filename.c_str(), s.name.c_str(), e.value
+								u.filename.c_str(), names[s.name_id].c_str(), e.value
 							);
 						}
 
-						auto iter = symbol_table.find(ee->name);
-						if (iter == symbol_table.end()) {
+						const auto &si = symbol_table[ee->name_id];
+						if (!si.defined) {
 							errx(1, "%s: %s Unable to find extern symbol %s",
-								u.filename.c_str(), s.name.c_str(), ee->name.c_str()
+								u.filename.c_str(), names[s.name_id].c_str(), names[ee->name_id].c_str()
 							);
 						}
-						const auto &si = iter->second;
 
 						e.value = si.value;
 						// could be an EQU
@@ -613,7 +1445,7 @@ int main(int argc, char **argv) {
 						}
 					}
 				}
-				simplify(r);
+				simplify(u, r);
 			}
 		}
 	}
@@ -624,11 +1456,49 @@ int main(int argc, char **argv) {
 	if (verbose) {
 		print_symbols();
 		print_segments(segments);
+		if (!cache_dir.empty())
+			printf("Cache: %u hits, %u misses\n", (unsigned)cache_hits, (unsigned)cache_misses);
+		if (!libraries.empty())
+			printf("Libraries: %u members loaded\n", members);
+		if (gc)
+			printf("Sections: %u of %u removed, $%06x bytes\n", gs.removed, gs.sections, gs.bytes);
+		if (merge)
+			printf("Merged: %u strings, $%06x bytes saved\n", merged, merged_bytes);
+		if (icf)
+			printf("Folded: %u sections, $%06x bytes saved\n", folded, folded_bytes);
+		if (link_type >= 3) {
+			uint32_t total = 0;
+			for (const auto &seg : segments) total += seg.data.size();
+			unsigned minimum = (total + 0xffff) >> 16;
+			printf("Packing: %u segments (%u minimum), $%06x bytes, %.1f%% full\n",
+				(unsigned)segments.size(), minimum, total,
+				segments.empty() ? 0.0 : total * 100.0 / (segments.size() * 0x10000)
+			);
+		}
+		if (link_type == 4) {
+			printf("Partition: %u of %u references cross segments (%u with -l 3)\n",
+				packing.cut_after, packing.references, packing.cut_before
+			);
+		}
+		if (profiled)
+			print_heat(units, segments, samples, missed);
+		if (ra.mode() != readahead::none)
+			printf("Read-ahead: %s\n", readahead::mode_name(ra.mode()));
 	}
 
-	save_omf(outfile, segments, omf_flags);
+	uint32_t dictionary = save_omf(outfile, segments, omf_flags);
 	set_file_type(outfile, file_type, aux_type);
 
+	if (verbose && link_type >= 3) {
+		unsigned relocs = 0;
+		unsigned intersegs = 0;
+		for (const auto &seg : segments) {
+			relocs += seg.relocs.size();
+			intersegs += seg.intersegs.size();
+		}
+		printf("Relocations: %u RELOC, %u INTERSEG, $%06x dictionary bytes\n", relocs, intersegs, dictionary);
+	}
+
 
 
 	return 0;
@@ -241,7 +241,7 @@ namespace {
 void mapped_file_base::close() {
 	if (is_open()) {
 		::munmap(_data, _size);
-		::close(_fd);
+		if (_fd >= 0) ::close(_fd);
 		reset();
 	}
 }
@@ -296,7 +296,8 @@ void mapped_file_base::open(const std::string& p, mapmode flags, size_t length,
 		return set_or_throw_error(ec, "mmap");
 	}
 
-	_fd = close_fd.release();
+	// the mapping remains valid after the descriptor is closed.  the linker
+	// keeps every object mapped, so don't hold on to a descriptor per file.
 	_size = length;
 	_flags = flags;
 }
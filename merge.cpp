@@ -0,0 +1,353 @@
+/*
+ * merge duplicate strings.
+ *
+ * sections named .str (or .str.*) hold NUL-terminated strings which
+ * nothing depends on the order of.  for each group, the strings from
+ * every such section are pooled: duplicates are stored once, and a
+ * string which is the tail of another points into it.  the first
+ * section gets the pool; the others are folded into it.
+ *
+ * symbols in the sections are moved to their string's new location, and
+ * so are section references -- the section's address plus a constant
+ * (which is how the assembler references a label in the section).  a
+ * section referenced any other way keeps its own strings.
+ */
+
+#include <vector>
+#include <string_view>
+#include <unordered_map>
+#include <algorithm>
+#include <utility>
+#include <cstring>
+
+#include <err.h>
+
+#include "sn.h"
+
+namespace {
+
+	bool is_mergeable_name(std::string_view name) {
+		return name == ".str" || name.substr(0, 5) == ".str.";
+	}
+
+	struct candidate {
+		unsigned unit = 0;
+		sn_section *section = nullptr;
+		unsigned group_name = 0;
+		bool pinned = false;
+
+		std::vector<uint8_t> bytes;
+		std::vector<uint32_t> starts; // offset of each string
+		std::vector<uint32_t> pool; // pool offset of each string
+		sn_section *leader = nullptr;
+
+		// new offset of an offset into the section.
+		uint32_t map(uint32_t offset) const {
+			auto iter = std::upper_bound(starts.begin(), starts.end(), offset);
+			unsigned i = iter - starts.begin() - 1;
+			return pool[i] + offset - starts[i];
+		}
+	};
+
+	// parent token index of each token (-1 for the root).
+	void parents(sn_const_expr expr, std::vector<int> &rv) {
+		struct frame { int index; unsigned operands; };
+		std::vector<frame> stack;
+
+		rv.resize(expr.size());
+		for (unsigned i = 0; i < expr.size(); ++i) {
+			rv[i] = stack.empty() ? -1 : stack.back().index;
+			if (!stack.empty() && --stack.back().operands == 0) stack.pop_back();
+			unsigned op = expr[i].op;
+			if (op >= OP_EQ && op <= OP_MOD)
+				stack.push_back(frame{ (int)i, 2 });
+		}
+	}
+
+	// index of the other operand of parent, if it's a single token.
+	int sibling(sn_const_expr expr, const std::vector<int> &parent, unsigned p, unsigned k) {
+		for (unsigned i = p + 1; i < expr.size(); ++i) {
+			if (parent[i] == (int)p && i != k) {
+				unsigned op = expr[i].op;
+				return (op >= OP_EQ && op <= OP_MOD) ? -1 : (int)i;
+			}
+		}
+		return -1;
+	}
+
+	// how a section reference is used.  returns false if it can't be moved.
+	// offset is the constant added to it; konst is that token (or -1).
+	bool classify(sn_const_expr expr, const std::vector<int> &parent, unsigned k, uint32_t &offset, int &konst) {
+		offset = 0;
+		konst = -1;
+
+		int p = parent[k];
+		if (p >= 0 && expr[p].op == OP_ADD) {
+			int s = sibling(expr, parent, p, k);
+			if (s < 0 || expr[s].op != V_CONST) return false;
+			offset = expr[s].value;
+			konst = s;
+			p = parent[p];
+		}
+
+		// shifts, masks, etc. of the address are fine; differences aren't.
+		for (; p >= 0; p = parent[p]) {
+			switch (expr[p].op) {
+			case OP_AND: case OP_OR: case OP_XOR:
+			case OP_LSHIFT: case OP_RSHIFT:
+				break;
+			default:
+				return false;
+			}
+		}
+		return true;
+	}
+}
+
+/*
+ * returns the number of strings merged away.  bytes is set to the
+ * number of bytes saved.
+ */
+unsigned merge_strings(std::vector<sn_unit> &units, uint32_t &bytes) {
+
+	bytes = 0;
+
+	std::vector<candidate> candidates;
+	std::unordered_map<const sn_section *, unsigned> lookup;
+
+	for (unsigned i = 0; i < units.size(); ++i) {
+		auto &u = units[i];
+		for (auto &s : u.sections) {
+			if (!is_mergeable_name(s.name) || s.folded) continue;
+			if (!s.relocs.empty() || !s.patches.empty() || !s.size) continue;
+
+			unsigned group_name = 0;
+			if (s.group_id) {
+				auto g = u.find_group(s.group_id);
+				if (!g) continue;
+				group_name = g->name_id;
+			}
+
+			candidate c;
+			c.unit = i;
+			c.section = &s;
+			c.group_name = group_name;
+			c.bytes.reserve(s.size);
+			for (const auto &d : s.data) {
+				if (d.data) c.bytes.insert(c.bytes.end(), d.data, d.data + d.size);
+				else c.bytes.insert(c.bytes.end(), d.size, 0);
+			}
+			if (c.bytes.back() != 0) continue;
+
+			for (uint32_t offset = 0; offset < c.bytes.size(); ) {
+				c.starts.push_back(offset);
+				offset += strlen((const char *)c.bytes.data() + offset) + 1;
+			}
+
+			lookup.emplace(&s, candidates.size());
+			candidates.emplace_back(std::move(c));
+		}
+	}
+	if (candidates.empty()) return 0;
+
+
+	auto find_candidate = [&](sn_unit &u, unsigned section_id) -> candidate * {
+		auto ss = u.find_section(section_id);
+		if (!ss) return nullptr;
+		auto iter = lookup.find(ss);
+		return iter == lookup.end() ? nullptr : &candidates[iter->second];
+	};
+
+
+	// pin anything referenced in a way that can't be moved.
+	std::vector<int> parent;
+	for (auto &u : units) {
+		for (const auto &sym : u.globals) {
+			if (!sym.section_id) continue;
+			if (auto c = find_candidate(u, sym.section_id)) {
+				if (sym.value >= c->bytes.size()) c->pinned = true;
+			}
+		}
+		for (const auto &s : u.sections) {
+			for (const auto &r : s.relocs) {
+				auto expr = std::as_const(u).expr(r);
+				parents(expr, parent);
+				for (unsigned k = 0; k < expr.size(); ++k) {
+					unsigned op = expr[k].op;
+					if (op == V_SECTION) {
+						auto c = find_candidate(u, expr[k].value);
+						if (!c) continue;
+						uint32_t offset;
+						int konst;
+						if (!classify(expr, parent, k, offset, konst) || offset >= c->bytes.size())
+							c->pinned = true;
+					}
+					if (op == V_FN_SECT || op == V_FN_SECT_END) {
+						if (auto c = find_candidate(u, expr[k].value)) c->pinned = true;
+					}
+				}
+			}
+		}
+	}
+
+
+	// pools, by (group name, section name), in section order.
+	std::unordered_map<uint64_t, std::vector<unsigned>> buckets;
+	std::vector<uint64_t> order;
+	for (unsigned i = 0; i < candidates.size(); ++i) {
+		const auto &c = candidates[i];
+		if (c.pinned) continue;
+		uint64_t k = ((uint64_t)c.group_name << 32) | c.section->name_id;
+		auto &v = buckets[k];
+		if (v.empty()) order.push_back(k);
+		v.push_back(i);
+	}
+
+	unsigned merged = 0;
+	for (auto k : order) {
+		const auto &members = buckets[k];
+
+		// unique strings (including the NUL), in first-seen order.
+		std::vector<std::string_view> strings;
+		std::unordered_map<std::string_view, unsigned> unique;
+		uint32_t total = 0;
+		unsigned count = 0;
+		for (auto i : members) {
+			auto &c = candidates[i];
+			c.pool.resize(c.starts.size());
+			for (unsigned j = 0; j < c.starts.size(); ++j) {
+				uint32_t end = j + 1 < c.starts.size() ? c.starts[j + 1] : c.bytes.size();
+				std::string_view sv((const char *)c.bytes.data() + c.starts[j], end - c.starts[j]);
+				auto iter = unique.emplace(sv, strings.size()).first;
+				if (iter->second == strings.size()) strings.push_back(sv);
+				c.pool[j] = iter->second; // (string index for now)
+				total += sv.size();
+				++count;
+			}
+		}
+
+		// tails.  sorted by the reversed string, a string is followed by
+		// the strings it's a tail of.
+		std::vector<unsigned> sorted(strings.size());
+		for (unsigned i = 0; i < sorted.size(); ++i) sorted[i] = i;
+		std::sort(sorted.begin(), sorted.end(), [&](unsigned a, unsigned b){
+			const auto &x = strings[a];
+			const auto &y = strings[b];
+			return std::lexicographical_compare(x.rbegin(), x.rend(), y.rbegin(), y.rend());
+		});
+
+		auto is_tail = [](std::string_view tail, std::string_view s){
+			return tail.size() <= s.size() && s.substr(s.size() - tail.size()) == tail;
+		};
+
+		std::vector<int> container(strings.size(), -1);
+		for (unsigned i = sorted.size(); i-- > 1; ) {
+			unsigned a = sorted[i - 1];
+			unsigned b = sorted[i];
+			if (is_tail(strings[a], strings[b]))
+				container[a] = container[b] < 0 ? b : container[b];
+		}
+
+		std::vector<uint32_t> position(strings.size());
+		std::vector<uint8_t> pool;
+		for (unsigned i = 0; i < strings.size(); ++i) {
+			if (container[i] >= 0) continue;
+			position[i] = pool.size();
+			pool.insert(pool.end(), strings[i].begin(), strings[i].end());
+		}
+		for (unsigned i = 0; i < strings.size(); ++i) {
+			if (container[i] < 0) continue;
+			const auto &s = strings[container[i]];
+			position[i] = position[container[i]] + s.size() - strings[i].size();
+		}
+
+
+		// the first section gets the pool.
+		auto &first = candidates[members.front()];
+		auto &lu = units[first.unit];
+		auto buffer = (uint8_t *)lu.arena->allocate(pool.size(), 1);
+		memcpy(buffer, pool.data(), pool.size());
+
+		auto leader = first.section;
+		leader->data.clear();
+		leader->data.push_back(sn_data{ buffer, (uint32_t)pool.size() });
+		leader->size = pool.size();
+
+		for (auto i : members) {
+			auto &c = candidates[i];
+			for (auto &p : c.pool) p = position[p];
+			c.leader = leader;
+			if (c.section != leader) c.section->folded = leader;
+		}
+
+		for (unsigned i = 0; i < strings.size(); ++i)
+			if (container[i] < 0) --count;
+		merged += count;
+		bytes += total - pool.size();
+	}
+
+
+	// move the symbols and section references.
+	for (auto &u : units) {
+		for (auto &sym : u.globals) {
+			if (!sym.section_id) continue;
+			auto c = find_candidate(u, sym.section_id);
+			if (c && c->leader) sym.value = c->map(sym.value);
+		}
+		for (auto &sym : u.locals) {
+			if (!sym.section_id) continue;
+			auto c = find_candidate(u, sym.section_id);
+			if (c && c->leader && sym.value < c->bytes.size()) sym.value = c->map(sym.value);
+		}
+
+		for (auto &s : u.sections) {
+			for (auto &r : s.relocs) {
+				auto expr = u.expr(r);
+				sn_const_expr cexpr{ expr.begin(), expr.size() };
+				parents(cexpr, parent);
+
+				// bare references which need an offset added.
+				std::vector<std::pair<unsigned, uint32_t>> bare;
+
+				for (unsigned k = 0; k < expr.size(); ++k) {
+					if (expr[k].op != V_SECTION) continue;
+
+					auto c = find_candidate(u, expr[k].value);
+					if (!c || !c->leader) continue;
+
+					uint32_t offset;
+					int konst;
+					classify(cexpr, parent, k, offset, konst);
+					uint32_t delta = c->map(offset);
+
+					if (konst >= 0) expr[konst].value = delta;
+					else if (delta) bare.emplace_back(k, delta);
+				}
+				if (bare.empty()) continue;
+
+				// section -> + section delta
+				std::vector<expr_token> tokens;
+				tokens.reserve(expr.size() + bare.size() * 2);
+				auto iter = bare.begin();
+				for (unsigned k = 0; k < expr.size(); ++k) {
+					if (iter != bare.end() && iter->first == k) {
+						tokens.push_back(expr_token{ OP_ADD, 0 });
+						tokens.push_back(expr[k]);
+						tokens.push_back(expr_token{ V_CONST, iter->second });
+						++iter;
+						continue;
+					}
+					tokens.push_back(expr[k]);
+				}
+				if (tokens.size() > 0xffff)
+					errx(1, "%s: Relocation expression too large", u.filename.c_str());
+
+				r.expr_offset = u.tokens.size();
+				r.expr_size = tokens.size();
+				u.tokens.insert(u.tokens.end(), tokens.begin(), tokens.end());
+			}
+		}
+	}
+
+	return merged;
+}
@@ -120,7 +120,7 @@ int main(int argc, char **argv) {
 			unsigned type = 0;
 		};
 
-		sn_parse_unit(argv[i], u);
+		sn_parse_unit(argv[i], u, SN_SYMBOLS_ONLY);
 
 
 		std::vector<xsym> syms;
@@ -132,7 +132,7 @@ int main(int argc, char **argv) {
 				unsigned type = 't'; // local text
 				if (e.section_id == 0) type = 'a'; // local absolute
 
-				syms.push_back(xsym{e.name, e.value, type});
+				syms.push_back(xsym{std::string(e.name), e.value, type});
 			}
 		}
 
@@ -141,14 +141,14 @@ int main(int argc, char **argv) {
 				unsigned type = 'T'; // global text
 				if (e.section_id == 0) type = 'A'; // global absolute
 
-				syms.push_back(xsym{e.name, e.value, type});
+				syms.push_back(xsym{std::string(e.name), e.value, type});
 			}
 		}
 
 
 		if (include_extern) {
 			for (const auto &e : u.externs) {
-				syms.push_back(xsym{e.name, 0, 'U'});
+				syms.push_back(xsym{std::string(e.name), 0, 'U'});
 			}
 		}
 
@@ -14,9 +14,8 @@
 // #include "optional.h"
 #include <optional>
 
-#ifndef O_BINARY
-#define O_BINARY 0
-#endif
+#include "util.h"
+
 
 enum class endian {
 #ifdef _WIN32
@@ -288,7 +287,11 @@ enum {
 	SUPER_INTERSEG36,
 };
 
-uint32_t add_relocs(std::vector<uint8_t> &data, size_t data_offset, omf::segment &seg, bool compress, bool super) {
+/*
+ * reloc records are appended to data.  super records also patch the
+ * segment data in place (lconst), which is written out as-is.
+ */
+uint32_t add_relocs(std::vector<uint8_t> &data, uint8_t *lconst, omf::segment &seg, bool compress, bool super) {
 
 	std::array< std::optional<super_helper>, 38 > ss;
 
@@ -309,7 +312,7 @@ uint32_t add_relocs(std::vector<uint8_t> &data, size_t data_offset, omf::segment
 
 					uint32_t value = r.value;
 					for (int i = 0; i < 2; ++i, value >>= 8)
-						data[data_offset + r.offset + i] = value; 
+						lconst[r.offset + i] = value; 
 					continue;
 				}
 
@@ -325,7 +328,7 @@ uint32_t add_relocs(std::vector<uint8_t> &data, size_t data_offset, omf::segment
 
 					uint32_t value = r.value;
 					for (int i = 0; i < 3; ++i, value >>= 8)
-						data[data_offset + r.offset + i] = value; 
+						lconst[r.offset + i] = value; 
 					continue;	
 				}
 
@@ -340,7 +343,7 @@ uint32_t add_relocs(std::vector<uint8_t> &data, size_t data_offset, omf::segment
 
 					uint32_t value = r.value;
 					for (int i = 0; i < 2; ++i, value >>= 8)
-						data[data_offset + r.offset + i] = value; 
+						lconst[r.offset + i] = value; 
 					continue;
 				}
 			}
@@ -374,9 +377,9 @@ uint32_t add_relocs(std::vector<uint8_t> &data, size_t data_offset, omf::segment
 
 					uint32_t value = r.segment_offset;
 
-					data[data_offset + r.offset + 0] = value; value >>= 8;
-					data[data_offset + r.offset + 1] = value; value >>= 8;
-					data[data_offset + r.offset + 2] = r.segment;
+					lconst[r.offset + 0] = value; value >>= 8;
+					lconst[r.offset + 1] = value; value >>= 8;
+					lconst[r.offset + 2] = r.segment;
 					continue;
 				}
 
@@ -390,7 +393,7 @@ uint32_t add_relocs(std::vector<uint8_t> &data, size_t data_offset, omf::segment
 
 					uint32_t value = r.segment_offset;
 					for (int i = 0; i < 2; ++i, value >>= 8)
-						data[data_offset + r.offset + i] = value; 
+						lconst[r.offset + i] = value; 
 					continue;
 				}
 
@@ -403,7 +406,7 @@ uint32_t add_relocs(std::vector<uint8_t> &data, size_t data_offset, omf::segment
 
 					uint32_t value = r.segment_offset;
 					for (int i = 0; i < 2; ++i, value >>= 8)
-						data[data_offset + r.offset + i] = value; 
+						lconst[r.offset + i] = value; 
 					continue;
 				}
 			}
@@ -480,7 +483,7 @@ void save_bin(const std::string &path, omf::segment &segment) {
 }
 
 
-void save_omf(const std::string &path, std::vector<omf::segment> &segments, unsigned flags) {
+uint32_t save_omf(const std::string &path, std::vector<omf::segment> &segments, unsigned flags) {
 
 	// expressload doesn't support links to other files. 
 	// fortunately, we don't either.
@@ -507,6 +510,7 @@ void save_omf(const std::string &path, std::vector<omf::segment> &segments, unsi
 
 
 	uint32_t offset = 0;
+	uint32_t dictionary = 0;
 	if (expressload) {
 		for (auto &s : segments) {
 			s.segnum++;
@@ -533,7 +537,7 @@ void save_omf(const std::string &path, std::vector<omf::segment> &segments, unsi
 		omf_header h;
 		h.length = s.data.size() + s.reserved_space;
 		h.kind = s.kind;
-		h.banksize = s.data.size() > 0xffff ? 0x0000 : 0x010000;
+		h.banksize = s.data.size() > 0x10000 ? 0x0000 : 0x010000;
 		h.segnum = s.segnum;
 		h.alignment = s.alignment;
 		h.reserved_space = s.reserved_space;
@@ -567,23 +571,20 @@ void save_omf(const std::string &path, std::vector<omf::segment> &segments, unsi
 		push(data, (uint8_t)omf::LCONST);
 		push(data, (uint32_t)lconst_size);
 
-		size_t data_offset = data.size();
-
-		data.insert(data.end(), s.data.begin(), s.data.end());
+		// the lconst data is written directly from the segment rather than
+		// copied into data.
+		size_t prefix_size = data.size();
 
-		if (reserved_space) {
-			data.insert(data.end(), reserved_space, 0);
-		}
-
-		uint32_t reloc_offset = offset + sizeof(omf_header) + data.size();
+		uint32_t reloc_offset = lconst_offset + lconst_size;
 		uint32_t reloc_size = 0;
 
-		reloc_size = add_relocs(data, data_offset, s, compress, super);
+		reloc_size = add_relocs(data, s.data.data(), s, compress, super);
+		dictionary += reloc_size;
 
 		// end-of-record
 		push(data, (uint8_t)omf::END);
 
-		h.bytecount = data.size() + sizeof(omf_header);
+		h.bytecount = data.size() + lconst_size + sizeof(omf_header);
 
 		if (expressload) {
 
@@ -622,7 +623,13 @@ void save_omf(const std::string &path, std::vector<omf::segment> &segments, unsi
 		to_little(h);
 
 		offset += write(fd, &h, sizeof(h));
-		offset += write(fd, data.data(), data.size());
+		offset += write(fd, data.data(), prefix_size);
+		offset += write(fd, s.data.data(), s.data.size());
+		if (reserved_space) {
+			std::vector<uint8_t> zero(reserved_space, 0);
+			offset += write(fd, zero.data(), zero.size());
+		}
+		offset += write(fd, data.data() + prefix_size, data.size() - prefix_size);
 
 		// version 1 needs 512-byte padding for all but final segment.
 		if (v1 && &s != &segments.back()) {
@@ -677,4 +684,5 @@ void save_omf(const std::string &path, std::vector<omf::segment> &segments, unsi
 	}
 
 	close(fd);
+	return dictionary;
 }
@@ -90,7 +90,8 @@ enum {
 
 };
 
-void save_omf(const std::string &path, std::vector<omf::segment> &segments, unsigned flags);
+// returns the size of the relocation dictionaries.
+uint32_t save_omf(const std::string &path, std::vector<omf::segment> &segments, unsigned flags);
 void save_bin(const std::string &path, omf::segment &segment);
 
 
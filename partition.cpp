@@ -0,0 +1,173 @@
+/*
+ * reference graph partitioning.
+ *
+ * sections are the nodes; every relocation token referencing another
+ * section (directly or through an extern) is an edge.  sections are split
+ * into bank sized bins so that as few references as possible cross bins,
+ * since each of those becomes an INTERSEG record.
+ *
+ * bins are grown one at a time from the first unassigned section, taking
+ * the section with the most references into the bin which still fits.
+ * then sections are moved to whichever bin they reference most, while
+ * that reduces the cut and the bin has room.
+ */
+
+#include <vector>
+#include <queue>
+#include <unordered_map>
+#include <algorithm>
+#include <cstdint>
+
+namespace {
+
+	struct neighbor {
+		unsigned item;
+		unsigned weight;
+	};
+
+	struct graph {
+		std::vector<unsigned> first; // items + 1
+		std::vector<neighbor> edges;
+
+		const neighbor *begin(unsigned i) const { return edges.data() + first[i]; }
+		const neighbor *end(unsigned i) const { return edges.data() + first[i + 1]; }
+	};
+
+	// undirected, with parallel edges combined.
+	graph build(unsigned count, const std::vector<std::pair<unsigned, unsigned>> &pairs, const std::vector<unsigned> &weights) {
+
+		struct edge { unsigned a, b, weight; };
+		std::vector<edge> v;
+		v.reserve(pairs.size() * 2);
+		for (unsigned i = 0; i < pairs.size(); ++i) {
+			auto [a, b] = pairs[i];
+			unsigned w = weights.empty() ? 1 : weights[i];
+			if (a == b) continue;
+			v.push_back(edge{ a, b, w });
+			v.push_back(edge{ b, a, w });
+		}
+		std::sort(v.begin(), v.end(), [](const edge &x, const edge &y){
+			return std::pair(x.a, x.b) < std::pair(y.a, y.b);
+		});
+
+		graph g;
+		g.first.assign(count + 1, 0);
+		for (unsigned i = 0; i < v.size(); ) {
+			unsigned w = 0;
+			unsigned j = i;
+			for (; j < v.size() && v[j].a == v[i].a && v[j].b == v[i].b; ++j) w += v[j].weight;
+			g.edges.push_back(neighbor{ v[i].b, w });
+			g.first[v[i].a + 1]++;
+			i = j;
+		}
+		for (unsigned i = 0; i < count; ++i) g.first[i + 1] += g.first[i];
+		return g;
+	}
+}
+
+/*
+ * returns the bin of each item.  a bin only holds items of one kind
+ * and at most capacity bytes (unless it's a single larger item).
+ * weights are per pair (empty = 1 each).
+ */
+std::vector<unsigned> partition_graph(const std::vector<uint32_t> &sizes, const std::vector<unsigned> &kinds,
+	const std::vector<std::pair<unsigned, unsigned>> &pairs, const std::vector<unsigned> &weights, uint32_t capacity) {
+
+	const unsigned none = -1;
+	unsigned count = sizes.size();
+
+	auto g = build(count, pairs, weights);
+
+	std::vector<unsigned> bin(count, none);
+	std::vector<uint32_t> used;
+	std::vector<unsigned> bin_kind;
+
+
+	// grow the bins.
+	std::vector<unsigned> gain(count);
+	std::vector<unsigned> touched;
+	typedef std::pair<unsigned, int> entry; // gain, -item (lowest first)
+	unsigned next = 0;
+
+	for (;;) {
+		while (next < count && bin[next] != none) ++next;
+		if (next == count) break;
+
+		unsigned b = used.size();
+		unsigned kind = kinds[next];
+		used.push_back(0);
+		bin_kind.push_back(kind);
+
+		std::priority_queue<entry> queue;
+		for (auto i : touched) gain[i] = 0;
+		touched.clear();
+
+		auto add = [&](unsigned i){
+			bin[i] = b;
+			used[b] += sizes[i];
+			for (auto n = g.begin(i); n != g.end(i); ++n) {
+				unsigned j = n->item;
+				if (bin[j] != none || kinds[j] != kind) continue;
+				if (!gain[j]) touched.push_back(j);
+				gain[j] += n->weight;
+				queue.emplace(gain[j], -(int)j);
+			}
+		};
+
+		add(next);
+		unsigned scan = next;
+		for (;;) {
+			if (!queue.empty()) {
+				auto [w, k] = queue.top();
+				queue.pop();
+				unsigned i = -k;
+				// stale, or it will never fit.
+				if (bin[i] != none || w != gain[i]) continue;
+				if (used[b] + sizes[i] > capacity) continue;
+				add(i);
+				continue;
+			}
+
+			// nothing referenced fits; take the next section that does.
+			while (scan < count && (bin[scan] != none || kinds[scan] != kind || used[b] + sizes[scan] > capacity))
+				++scan;
+			if (scan == count) break;
+			add(scan);
+		}
+	}
+
+
+	// refine.
+	std::unordered_map<unsigned, unsigned> weight;
+	for (unsigned pass = 0; pass < 8; ++pass) {
+		unsigned moved = 0;
+		for (unsigned i = 0; i < count; ++i) {
+			unsigned from = bin[i];
+			weight.clear();
+			for (auto n = g.begin(i); n != g.end(i); ++n)
+				weight[bin[n->item]] += n->weight;
+
+			// (ties go to the lowest bin, so the result doesn't depend on the map.)
+			unsigned current = weight[from];
+			unsigned best = from;
+			unsigned best_weight = current;
+			for (auto [b, w] : weight) {
+				if (w <= current || w < best_weight) continue;
+				if (w == best_weight && best != from && b > best) continue;
+				if (bin_kind[b] != kinds[i]) continue;
+				if (used[b] + sizes[i] > capacity) continue;
+				best = b;
+				best_weight = w;
+			}
+			if (best == from) continue;
+
+			used[from] -= sizes[i];
+			used[best] += sizes[i];
+			bin[i] = best;
+			++moved;
+		}
+		if (!moved) break;
+	}
+
+	return bin;
+}
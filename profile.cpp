@@ -0,0 +1,114 @@
+#include "profile.h"
+
+#include <fstream>
+#include <stdexcept>
+#include <cctype>
+#include <cstdlib>
+#include <cerrno>
+
+namespace {
+
+	bool is_hex(const std::string &s) {
+		if (s.empty()) return false;
+		for (char c : s)
+			if (!isxdigit((unsigned char)c)) return false;
+		return true;
+	}
+
+	uint64_t hex_number(const std::string &s, uint64_t max) {
+		if (!is_hex(s)) throw std::runtime_error("Bad number: " + s);
+		errno = 0;
+		auto rv = std::strtoull(s.c_str(), nullptr, 16);
+		if (errno || rv > max) throw std::runtime_error("Bad number: " + s);
+		return rv;
+	}
+
+	// $ or 0x is hex, otherwise decimal.
+	uint64_t number(const std::string &s, uint64_t max) {
+		if (s.size() > 1 && s[0] == '$') return hex_number(s.substr(1), max);
+		if (s.size() > 2 && s[0] == '0' && (s[1] == 'x' || s[1] == 'X')) return hex_number(s.substr(2), max);
+
+		if (s.empty() || s.find_first_not_of("0123456789") != s.npos)
+			throw std::runtime_error("Bad number: " + s);
+		errno = 0;
+		auto rv = std::strtoull(s.c_str(), nullptr, 10);
+		if (errno || rv > max) throw std::runtime_error("Bad number: " + s);
+		return rv;
+	}
+
+	bool is_address(const std::string &s) {
+		return (s.size() > 1 && s[0] == '$') || (s.size() > 2 && s[0] == '0' && (s[1] == 'x' || s[1] == 'X'));
+	}
+
+	void parse_line(const std::string &line, profile &p) {
+
+		std::vector<std::string> words;
+		size_t i = 0;
+		for (;;) {
+			while (i < line.size() && isspace((unsigned char)line[i])) ++i;
+			if (i == line.size() || line[i] == '#') break;
+			size_t j = i;
+			while (j < line.size() && !isspace((unsigned char)line[j])) ++j;
+			words.emplace_back(line.substr(i, j - i));
+			i = j;
+		}
+
+		if (words.empty()) return;
+		if (words.size() > 2) throw std::runtime_error("Bad sample");
+
+		const auto &w = words[0];
+		if (w[0] == '@') {
+			if (words.size() != 2) throw std::runtime_error("Bad load address");
+			unsigned segnum = hex_number(w.substr(1), 0xffff);
+			uint32_t address = number(words[1], 0xffffff);
+			p.loads.emplace_back(segnum, address);
+			return;
+		}
+
+		profile_sample s;
+		s.count = words.size() == 2 ? number(words[1], UINT64_MAX) : 1;
+
+		auto slash = w.find('/');
+		if (is_address(w)) {
+			s.type = profile_sample::address;
+			s.offset = number(w, 0xffffff);
+		} else if (slash != w.npos && is_hex(w.substr(0, slash))) {
+			s.type = profile_sample::location;
+			s.segnum = hex_number(w.substr(0, slash), 0xffff);
+			s.offset = hex_number(w.substr(slash + 1), 0xffffffff);
+		} else {
+			// symbol[+offset].  (the offset doesn't matter, only the section.)
+			s.type = profile_sample::symbol;
+			s.name = w.substr(0, w.find('+'));
+		}
+		p.samples.emplace_back(std::move(s));
+	}
+}
+
+bool profile::needs_layout() const {
+	for (const auto &s : samples)
+		if (s.type != profile_sample::symbol) return true;
+	return false;
+}
+
+bool read_profile(const std::string &path, profile &p, std::string &error) {
+
+	std::ifstream f(path);
+	if (!f) {
+		error = "Unable to open " + path;
+		return false;
+	}
+
+	std::string line;
+	unsigned n = 0;
+	while (std::getline(f, line)) {
+		++n;
+		try {
+			parse_line(line, p);
+		} catch (std::runtime_error &e) {
+			error = path + ":" + std::to_string(n) + ": " + e.what();
+			return false;
+		}
+	}
+	return true;
+}
@@ -0,0 +1,44 @@
+#ifndef __profile_h__
+#define __profile_h__
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+/*
+ * execution profile (-p), as exported from an emulator.  one sample per
+ * line, a location and an optional count (default 1):
+ *
+ *	symbol[+offset] count     a global symbol
+ *	ss/oooo count             segment/offset, as printed by -v
+ *	$bboooo count             an address (0x... is also accepted)
+ *	@ss $bboooo               segment ss was loaded at $bboooo
+ *
+ * segments and addresses refer to the program as linked without -p (from
+ * the same files, with the same options).  # starts a comment.
+ */
+struct profile_sample {
+	enum type_type {
+		symbol,
+		location,
+		address,
+	};
+
+	type_type type = symbol;
+	std::string name;
+	unsigned segnum = 0;
+	uint32_t offset = 0; // (or the address)
+	uint64_t count = 0;
+};
+
+struct profile {
+	std::vector<profile_sample> samples;
+	std::vector<std::pair<unsigned, uint32_t>> loads; // segment, load address
+
+	// true if the samples need the unprofiled layout.
+	bool needs_layout() const;
+};
+
+bool read_profile(const std::string &path, profile &p, std::string &error);
+
+#endif
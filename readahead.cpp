@@ -0,0 +1,306 @@
+#include "readahead.h"
+#include "util.h"
+
+#include <algorithm>
+#include <vector>
+#include <cstring>
+#include <cerrno>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#define HAVE_IO_URING 1
+#endif
+
+namespace {
+
+	/*
+	 * open a regular file.  anything else is checked first without opening
+	 * it -- opening a fifo would release the writer, which then gets
+	 * SIGPIPE when it's closed again.
+	 */
+	int open_regular(const std::string &path, off_t &size) {
+		struct stat st;
+		if (stat(path.c_str(), &st) < 0 || !S_ISREG(st.st_mode)) return -1;
+
+		int fd = open(path.c_str(), O_RDONLY | O_BINARY);
+		if (fd >= 0) size = st.st_size;
+		return fd;
+	}
+
+	void fadvise_file(int fd) {
+#ifdef POSIX_FADV_WILLNEED
+		posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+#endif
+	}
+}
+
+
+#ifdef HAVE_IO_URING
+
+/*
+ * a minimal io_uring (without liburing).  reads go into a shared scratch
+ * buffer -- only the page cache side effect matters.  the queue depth
+ * bounds how far ahead it reads.
+ */
+struct readahead::ring {
+
+	static constexpr unsigned depth = 64;
+	static constexpr size_t chunk = 128 * 1024;
+
+	int fd = -1;
+	void *sq_ptr = MAP_FAILED;
+	void *cq_ptr = MAP_FAILED;
+	size_t sq_size = 0;
+	size_t cq_size = 0;
+	io_uring_sqe *sqes = (io_uring_sqe *)MAP_FAILED;
+	size_t sqes_size = 0;
+
+	unsigned *sq_tail = nullptr;
+	unsigned *sq_mask = nullptr;
+	unsigned *sq_array = nullptr;
+	unsigned *cq_head = nullptr;
+	unsigned *cq_tail = nullptr;
+	unsigned *cq_mask = nullptr;
+	io_uring_cqe *cqes = nullptr;
+
+	unsigned entries = 0;
+	unsigned queued = 0; // not yet submitted
+	unsigned inflight = 0; // submitted, not yet complete
+
+	// files being read, indexed by user_data.  closed after the last read completes.
+	struct file {
+		int fd = -1;
+		unsigned reads = 0;
+	};
+	std::vector<file> files;
+
+	uint8_t *scratch = nullptr;
+
+	bool open();
+	bool probe();
+	~ring();
+
+	void read(int fd, off_t size);
+	bool submit(unsigned wait);
+	void reap();
+};
+
+
+bool readahead::ring::open() {
+
+	io_uring_params p;
+	memset(&p, 0, sizeof(p));
+
+	fd = syscall(__NR_io_uring_setup, depth, &p);
+	if (fd < 0) return false;
+
+	sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	cq_size = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+	bool single = p.features & IORING_FEAT_SINGLE_MMAP;
+	if (single) sq_size = cq_size = std::max(sq_size, cq_size);
+
+	sq_ptr = mmap(nullptr, sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+	if (sq_ptr == MAP_FAILED) return false;
+
+	if (single) cq_ptr = sq_ptr;
+	else cq_ptr = mmap(nullptr, cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+	if (cq_ptr == MAP_FAILED) return false;
+
+	sqes_size = p.sq_entries * sizeof(io_uring_sqe);
+	sqes = (io_uring_sqe *)mmap(nullptr, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+	if (sqes == MAP_FAILED) return false;
+
+	auto sq = (uint8_t *)sq_ptr;
+	auto cq = (uint8_t *)cq_ptr;
+
+	sq_tail = (unsigned *)(sq + p.sq_off.tail);
+	sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+	sq_array = (unsigned *)(sq + p.sq_off.array);
+	cq_head = (unsigned *)(cq + p.cq_off.head);
+	cq_tail = (unsigned *)(cq + p.cq_off.tail);
+	cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+	cqes = (io_uring_cqe *)(cq + p.cq_off.cqes);
+
+	entries = p.sq_entries;
+	if (!probe()) return false;
+
+	scratch = new uint8_t[chunk];
+	return true;
+}
+
+// IORING_OP_READ is 5.6+.  older kernels fail the read in the completion,
+// so nothing would be read ahead.  (IORING_REGISTER_PROBE is 5.6+ too.)
+bool readahead::ring::probe() {
+
+	constexpr unsigned ops = 256;
+	std::vector<uint8_t> buffer(sizeof(io_uring_probe) + ops * sizeof(io_uring_probe_op));
+	auto p = (io_uring_probe *)buffer.data();
+
+	if (syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE, p, ops) < 0) return false;
+	if (p->last_op < IORING_OP_READ) return false;
+	return p->ops[IORING_OP_READ].flags & IO_URING_OP_SUPPORTED;
+}
+
+readahead::ring::~ring() {
+
+	// the kernel may still be writing to scratch.
+	while (queued + inflight) {
+		if (!submit(1)) break;
+	}
+	if (!inflight) delete []scratch;
+
+	for (auto &f : files) {
+		if (f.fd >= 0) close(f.fd);
+	}
+
+	if (sqes != MAP_FAILED) munmap(sqes, sqes_size);
+	if (cq_ptr != MAP_FAILED && cq_ptr != sq_ptr) munmap(cq_ptr, cq_size);
+	if (sq_ptr != MAP_FAILED) munmap(sq_ptr, sq_size);
+	if (fd >= 0) close(fd);
+}
+
+// submit queued reads and wait for (at least) wait completions.
+bool readahead::ring::submit(unsigned wait) {
+
+	for(;;) {
+		int n = syscall(__NR_io_uring_enter, fd, queued, wait, wait ? IORING_ENTER_GETEVENTS : 0, nullptr, 0);
+		if (n >= 0) {
+			queued -= n;
+			inflight += n;
+			break;
+		}
+		if (errno == EINTR) continue;
+		return false;
+	}
+	reap();
+	return true;
+}
+
+void readahead::ring::reap() {
+
+	unsigned head = *cq_head;
+	unsigned tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+
+	while (head != tail) {
+		const auto &cqe = cqes[head & *cq_mask];
+		auto &f = files[cqe.user_data];
+		if (--f.reads == 0) {
+			close(f.fd);
+			f.fd = -1;
+		}
+		--inflight;
+		++head;
+	}
+	__atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+}
+
+void readahead::ring::read(int file_fd, off_t size) {
+
+	auto iter = std::find_if(files.begin(), files.end(), [](const auto &f){
+		return f.fd < 0;
+	});
+	if (iter == files.end()) iter = files.emplace(files.end());
+	unsigned id = iter - files.begin();
+
+	files[id].fd = file_fd;
+
+	for (off_t offset = 0; offset < size; offset += chunk) {
+
+		// if the ring is full, the rest of the file isn't read ahead.
+		// waiting would stall the parse thread (which holds the lock).
+		if (queued + inflight >= entries) {
+			reap();
+			if (queued + inflight >= entries) break;
+		}
+
+		unsigned tail = *sq_tail;
+		unsigned index = tail & *sq_mask;
+		auto &sqe = sqes[index];
+
+		memset(&sqe, 0, sizeof(sqe));
+		sqe.opcode = IORING_OP_READ;
+		sqe.fd = file_fd;
+		sqe.off = offset;
+		sqe.addr = (uintptr_t)scratch;
+		sqe.len = std::min<off_t>(chunk, size - offset);
+		sqe.user_data = id;
+
+		sq_array[index] = index;
+		__atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+		++queued;
+		++files[id].reads;
+	}
+
+	if (!files[id].reads) {
+		close(file_fd);
+		files[id].fd = -1;
+	}
+
+	submit(0);
+}
+
+#else
+
+struct readahead::ring {
+	bool open() { return false; }
+	void read(int fd, off_t size) {}
+};
+
+#endif
+
+
+readahead::readahead(mode_type mode) : _mode(mode) {
+	if (_mode == uring) {
+		_ring.reset(new ring);
+		if (!_ring->open()) {
+			_ring.reset();
+			_mode = fadvise;
+		}
+	}
+}
+
+readahead::~readahead() {
+}
+
+void readahead::hint(const std::string &path) {
+
+	if (_mode == none) return;
+
+	off_t size;
+	int fd = open_regular(path, size);
+	if (fd < 0) return;
+
+	if (_mode == uring) {
+		std::lock_guard<std::mutex> lock(_mutex);
+		_ring->read(fd, size);
+		return;
+	}
+	fadvise_file(fd);
+	close(fd);
+}
+
+const char *readahead::mode_name(mode_type mode) {
+	switch(mode) {
+	case none: return "none";
+	case fadvise: return "fadvise";
+	case uring: return "uring";
+	}
+	return "";
+}
+
+bool readahead::parse_mode(const std::string &s, mode_type &mode) {
+	for (auto m : { none, fadvise, uring }) {
+		if (s == mode_name(m)) {
+			mode = m;
+			return true;
+		}
+	}
+	return false;
+}
@@ -0,0 +1,56 @@
+#ifndef __readahead_h__
+#define __readahead_h__
+
+#include <string>
+#include <memory>
+#include <mutex>
+
+/*
+ * read-ahead for input files.
+ *
+ * object files are mapped and faulted in as they're decoded, so with a
+ * cold page cache (or a network mounted build tree) the link stalls on
+ * each file in turn.  hint() starts reading a file that will be needed
+ * soon, without waiting for it.
+ *
+ * fadvise uses posix_fadvise(POSIX_FADV_WILLNEED).  uring reads the file
+ * (into a scratch buffer) with io_uring, which works even where the
+ * filesystem ignores fadvise; if io_uring (or its read opcode) isn't
+ * available, it falls back to fadvise.  hint() never waits for the ring:
+ * when it's full, the rest of the file isn't read ahead.
+ */
+class readahead {
+public:
+
+	enum mode_type {
+		none,
+		fadvise,
+		uring,
+	};
+
+	explicit readahead(mode_type mode);
+	~readahead();
+
+	readahead(const readahead &) = delete;
+	readahead &operator=(const readahead &) = delete;
+
+	// thread safe.  non-regular files (pipes, stdin) are ignored.
+	void hint(const std::string &path);
+
+	// the mode actually in use.
+	mode_type mode() const {
+		return _mode;
+	}
+
+	static const char *mode_name(mode_type mode);
+	static bool parse_mode(const std::string &s, mode_type &mode);
+
+private:
+	struct ring;
+
+	mode_type _mode;
+	std::mutex _mutex;
+	std::unique_ptr<ring> _ring;
+};
+
+#endif
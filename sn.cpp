@@ -1,92 +1,45 @@
 #include <algorithm>
 #include <string>
 #include <vector>
+#include <stdexcept>
 
 #include <cstring>
+#include <cstdlib>
+#include <cstdio>
+#include <cerrno>
 
 #include <err.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
 
 #include "mapped_file.h"
 #include "sn.h"
+#include "util.h"
 
-typedef mapped_file::iterator iter;
+typedef const uint8_t *iter;
 
 
+// string_view version -- the caller must keep the underlying data alive.
 template<class T>
-uint8_t read_8(T &iter) {
-	uint8_t tmp = *iter;
+std::string_view read_pstring_view(T &iter) {
+	unsigned size = *iter;
 	++iter;
-	return tmp;
-}
-
-template<class T>
-uint16_t read_16(T &iter) {
-	uint16_t tmp = 0;
-
-	tmp |= *iter << 0;
-	++iter;
-	tmp |= *iter << 8;
-	++iter;
-	return tmp;
-}
-
-template<class T>
-uint32_t read_32(T &iter) {
-	uint32_t tmp = 0;
-
-	tmp |= *iter << 0;
-	++iter;
-	tmp |= *iter << 8;
-	++iter;
-	tmp |= *iter << 16;
-	++iter;
-	tmp |= *iter << 24;
-	++iter;
-
-
-	return tmp;
-}
-
-template<class T>
-std::string read_cstring(T &iter) {
-	std::string s;
-	for(;;) {
-		uint8_t c = *iter;
-		++iter;
-		if (!c) break;
-		s.push_back(c);
-	}
+	std::string_view s((const char *)&*iter, size);
+	iter += size;
 	return s;
 }
 
 
-template<class T>
-std::string read_pstring(T &iter) {
-	std::string s;
-	unsigned  size = *iter;
-	++iter;
-	s.reserve(size);
-	while (size--) {
-		uint8_t c = *iter;
-		++iter;
-		s.push_back(c);
+static void append(std::pmr::vector<sn_data> &v, const uint8_t *data, uint32_t size) {
+	// merge adjacent ds records.
+	if (!data && !v.empty() && !v.back().data) {
+		v.back().size += size;
+		return;
 	}
-	return s;
-}
-
-
-[[maybe_unused]] static std::vector<uint8_t> &append(std::vector<uint8_t> &v, const std::vector<uint8_t> &w) {
-	v.insert(v.end(), w.begin(), w.end());
-	return v;	
+	v.emplace_back(sn_data{data, size});
 }
 
-template<class InputIt>
-static std::vector<uint8_t> &append(std::vector<uint8_t> &v, InputIt first, InputIt last) {
-	v.insert(v.end(), first, last);
-	return v;
-}
-
-
 
 sn_file *sn_unit::find_file(const std::string &name) {
 	auto iter = std::find_if(files.begin(), files.end(), [&name](const auto &x){
@@ -110,10 +63,8 @@ sn_group *sn_unit::find_group(const std::string &name) {
 }
 
 sn_group *sn_unit::find_group(unsigned id) {
-	auto iter = std::find_if(groups.begin(), groups.end(), [id](const auto &x){
-		return x.group_id == id;
-	});
-	return iter == groups.end() ? nullptr : &*iter;
+	auto ix = group_index.find(id);
+	return ix < 0 ? nullptr : &groups[ix];
 }
 
 sn_section *sn_unit::find_section(const std::string &name) {
@@ -124,10 +75,8 @@ sn_section *sn_unit::find_section(const std::string &name) {
 }
 
 sn_section *sn_unit::find_section(unsigned id) {
-	auto iter = std::find_if(sections.begin(), sections.end(), [id](const auto &x){
-		return x.section_id == id;
-	});
-	return iter == sections.end() ? nullptr : &*iter;
+	auto ix = section_index.find(id);
+	return ix < 0 ? nullptr : &sections[ix];
 }
 
 sn_symbol *sn_unit::find_extern(const std::string &name) {
@@ -138,10 +87,60 @@ sn_symbol *sn_unit::find_extern(const std::string &name) {
 }
 
 sn_symbol *sn_unit::find_extern(unsigned id) {
-	auto iter = std::find_if(externs.begin(), externs.end(), [id](const auto &x){
-		return x.symbol_id == id;
-	});
-	return iter == externs.end() ? nullptr : &*iter;
+	auto ix = extern_index.find(id);
+	return ix < 0 ? nullptr : &externs[ix];
+}
+
+/*
+ * ids are 16-bit and tend to be allocated sequentially, so a table
+ * spanning min id .. max id is small and gives O(1) lookups.
+ * if an id is duplicated, the first one wins (as with a linear search).
+ */
+template<class V, class F>
+static void build_index(sn_index &index, const V &v, F id_for) {
+
+	index.base = 0;
+	index.table.clear();
+	if (v.empty()) return;
+
+	unsigned lo = id_for(v.front());
+	unsigned hi = lo;
+	for (const auto &x : v) {
+		unsigned id = id_for(x);
+		lo = std::min(lo, id);
+		hi = std::max(hi, id);
+	}
+
+	index.base = lo;
+	index.table.resize(hi - lo + 1);
+	for (unsigned i = 0; i < v.size(); ++i) {
+		auto &slot = index.table[id_for(v[i]) - lo];
+		if (!slot) slot = i + 1;
+	}
+}
+
+void sn_unit::build_indexes() {
+	build_index(section_index, sections, [](const auto &x){ return x.section_id; });
+	build_index(group_index, groups, [](const auto &x){ return x.group_id; });
+	build_index(extern_index, externs, [](const auto &x){ return x.symbol_id; });
+}
+
+
+/*
+ * the arena is monotonic, so the memory isn't reclaimed until the unit
+ * is destroyed.  this is only used when a cached unit fails to load.
+ */
+void sn_unit::clear() {
+	sections.clear();
+	groups.clear();
+	files.clear();
+	locals.clear();
+	globals.clear();
+	externs.clear();
+	tokens.clear();
+	section_index.table.clear();
+	group_index.table.clear();
+	extern_index.table.clear();
 }
 
 
@@ -171,7 +170,37 @@ inline std::runtime_error bad_opcode(std::string msg, unsigned opcode) {
 	return std::runtime_error(msg);
 }
 
-iter parse_reloc(iter it, iter end, sn_reloc &out) {
+static inline uint32_t sn_bool(bool tf) { return tf ? 0xffffffff : 0; }
+
+uint32_t sn_eval(unsigned op, uint32_t a, uint32_t b) {
+	switch(op) {
+		case OP_EQ: return sn_bool(a == b);
+		case OP_NE: return sn_bool(a != b);
+		case OP_LE: return sn_bool(a <= b);
+		case OP_LT: return sn_bool(a < b);
+		case OP_GE: return sn_bool(a >= b);
+		case OP_GT: return sn_bool(a > b);
+		case OP_ADD: return a + b;
+		case OP_SUB: return a - b;
+		case OP_MUL: return a * b;
+		case OP_AND: return a & b;
+		case OP_OR: return a | b;
+		case OP_XOR: return a ^ b;
+		case OP_LSHIFT: return a << b;
+		case OP_RSHIFT: return a >> b;
+
+		case OP_DIV:
+			if (b == 0) return 0;
+			return (int32_t)a / (int32_t)b;
+		case OP_MOD:
+			if (b == 0) return 0;
+			return std::abs((int32_t)a % (int32_t)b);
+	}
+	return 0;
+}
+
+
+iter parse_reloc(iter it, iter end, sn_reloc &out, std::pmr::vector<expr_token> &expr) {
 
 	unsigned tokens = 1;
 
@@ -179,6 +208,7 @@ iter parse_reloc(iter it, iter end, sn_reloc &out) {
 
 	out.type = *it++;
 	out.address = read_16(it);
+	out.expr_offset = expr.size();
 
 	while(tokens) {
 		uint32_t value;
@@ -205,26 +235,99 @@ iter parse_reloc(iter it, iter end, sn_reloc &out) {
 		case OP_LSHIFT:
 		case OP_RSHIFT:
 		case OP_MOD:
-			out.expr.emplace_back(expr_token{ op, 0 });
+			expr.emplace_back(expr_token{ op, 0 });
 			tokens += 2;
 			break;
 
 		case V_CONST:
 			if (std::distance(it, end) < 4) throw eof();
 			value = read_32(it);
-			out.expr.emplace_back(expr_token{op, value});
+			expr.emplace_back(expr_token{op, value});
 			break;
 		case V_SECTION:
 		case V_EXTERN:
 			if (std::distance(it, end) < 2) throw eof();
 			value = read_16(it);
-			out.expr.emplace_back(expr_token{op, value});
+			expr.emplace_back(expr_token{op, value});
 			break;
 
 		default:
 			throw bad_opcode("Unknown relocation expression opcode", op);
 		}
 	}
+	out.expr_size = expr.size() - out.expr_offset;
+	return it;
+}
+
+/*
+ * fold a relocation with a constant expression into a patch.  returns
+ * the end of the record, or nullptr if it needs the linker -- references,
+ * a pc-relative or overflowing value (which are diagnosed at link time),
+ * or an address outside the section data so far.
+ */
+static iter fold_reloc(iter it, iter end, const sn_section &section, sn_patch &out) {
+
+	constexpr unsigned max_tokens = 16;
+	expr_token expr[max_tokens];
+	unsigned n = 0;
+
+	if (std::distance(it, end) < 4) throw eof();
+
+	unsigned type = *it++;
+	uint32_t address = read_16(it);
+
+	unsigned size = 0;
+	bool check = false;
+	switch(type) {
+		case RELOC_1: size = 1; break;
+		case RELOC_2: size = 2; break;
+		case RELOC_3: size = 3; break;
+		case RELOC_4: size = 4; break;
+		case RELOC_1_WARN: size = 1; check = true; break;
+		case RELOC_2_WARN: size = 2; check = true; break;
+		case RELOC_3_WARN: size = 3; check = true; break;
+		default:
+			return nullptr;
+	}
+	if (section.size < address + size) return nullptr;
+
+	for (unsigned tokens = 1; tokens; --tokens) {
+		if (it == end) throw eof();
+
+		unsigned op = *it++;
+		if (op == V_SECTION || op == V_EXTERN || n == max_tokens) return nullptr;
+
+		uint32_t value = 0;
+		if (op == V_CONST) {
+			if (std::distance(it, end) < 4) throw eof();
+			value = read_32(it);
+		} else if (op >= OP_EQ && op <= OP_MOD && !(op & 1)) {
+			tokens += 2;
+		} else {
+			throw bad_opcode("Unknown relocation expression opcode", op);
+		}
+		expr[n++] = expr_token{ op, value };
+	}
+
+	// evaluate backwards, as simplify() does.
+	uint32_t stack[max_tokens];
+	unsigned sp = 0;
+	while (n--) {
+		const auto &e = expr[n];
+		if (e.op == V_CONST) {
+			stack[sp++] = e.value;
+			continue;
+		}
+		--sp;
+		stack[sp - 1] = sn_eval(e.op, stack[sp - 1], stack[sp]);
+	}
+	uint32_t value = stack[0];
+
+	if (check && (size < 4) && value > (1 << (8 * size))) return nullptr;
+
+	out.address = address;
+	out.value = value;
+	out.size = size;
 	return it;
 }
 
@@ -234,7 +337,7 @@ iter parse_file(iter it, iter end, sn_file &file) {
 	file.file_id = read_16(it);
 	unsigned l = *it;
 	if (std::distance(it, end) < l + 1) throw eof();
-	file.name = read_pstring(it);
+	file.name = read_pstring_view(it);
 	return it;
 }
 
@@ -246,7 +349,7 @@ iter parse_group(iter it, iter end, sn_group &group) {
 	group.flags = *it++;
 	unsigned l = *it;
 	if (std::distance(it, end) < l + 1) throw eof();
-	group.name = read_pstring(it);
+	group.name = read_pstring_view(it);
 	return it;
 }
 
@@ -258,7 +361,7 @@ iter parse_section(iter it, iter end, sn_section &section) {
 	section.flags = *it++;
 	unsigned l = *it;
 	if (std::distance(it, end) < l + 1) throw eof();
-	section.name = read_pstring(it);
+	section.name = read_pstring_view(it);
 	return it;
 }
 
@@ -271,7 +374,7 @@ iter parse_global_symbol(iter it, iter end, sn_symbol &symbol) {
 
 	unsigned l = *it;
 	if (std::distance(it, end) < l + 1) throw eof();
-	symbol.name = read_pstring(it);
+	symbol.name = read_pstring_view(it);
 	return it;
 }
 
@@ -284,7 +387,7 @@ iter parse_local_symbol(iter it, iter end, sn_symbol &symbol) {
 
 	unsigned l = *it;
 	if (std::distance(it, end) < l + 1) throw eof();
-	symbol.name = read_pstring(it);
+	symbol.name = read_pstring_view(it);
 	return it;
 }
 
@@ -295,7 +398,7 @@ iter parse_extern_symbol(iter it, iter end, sn_symbol &symbol) {
 
 	unsigned l = *it;
 	if (std::distance(it, end) < l + 1) throw eof();
-	symbol.name = read_pstring(it);
+	symbol.name = read_pstring_view(it);
 	return it;
 }
 
@@ -309,41 +412,362 @@ iter skip_local_symbol(iter it, iter end) {
 	return it;
 }
 
+// skip a record of fixed bytes followed by a pstring.
+iter skip_pstring_record(iter it, iter end, unsigned fixed) {
+	if (std::distance(it, end) < fixed + 1) throw eof();
+	it += fixed;
+	unsigned l = *it++;
+	if (std::distance(it, end) < l) throw eof();
+	it += l;
+	return it;
+}
+
+// constant is set if it has no section or extern references.
+iter skip_reloc(iter it, iter end, unsigned &count, bool &constant) {
+
+	unsigned tokens = 1;
+
+	if (std::distance(it, end) < 4) throw eof();
+	it += 3; // uint8_t type, uint16_t address
+
+	constant = true;
+	unsigned n = 0;
+	while (tokens) {
+		--tokens;
+		++n;
+		if (it == end) throw eof();
+
+		unsigned op = *it++;
+		switch(op) {
+		case OP_EQ:
+		case OP_NE:
+		case OP_LE:
+		case OP_LT:
+		case OP_GE:
+		case OP_GT:
+		case OP_ADD:
+		case OP_SUB:
+		case OP_MUL:
+		case OP_DIV:
+		case OP_AND:
+		case OP_OR:
+		case OP_XOR:
+		case OP_LSHIFT:
+		case OP_RSHIFT:
+		case OP_MOD:
+			tokens += 2;
+			break;
+
+		case V_CONST:
+			if (std::distance(it, end) < 4) throw eof();
+			it += 4;
+			break;
+		case V_SECTION:
+		case V_EXTERN:
+			if (std::distance(it, end) < 2) throw eof();
+			it += 2;
+			constant = false;
+			break;
+
+		default:
+			throw bad_opcode("Unknown relocation expression opcode", op);
+		}
+	}
+	// sn_reloc::expr_size
+	if (n > 0xffff) throw std::runtime_error("Relocation expression too large");
+	count += n;
+	return it;
+}
+
+
+/*
+ * record counts, so the unit can be sized before decoding.
+ * per-section counts are indexed in 0x10 record order.
+ */
+struct unit_counts {
+	struct section_counts {
+		unsigned section_id = 0;
+		unsigned data = 0; // data and ds records
+		unsigned relocs = 0;
+		unsigned patches = 0; // constant relocs
+	};
+
+	unsigned groups = 0;
+	unsigned files = 0;
+	unsigned locals = 0;
+	unsigned globals = 0;
+	unsigned externs = 0;
+	unsigned tokens = 0;
+	std::vector<section_counts> sections;
+};
+
+/*
+ * first pass -- walk the records using only their length fields.
+ * this also validates the record structure (with the same errors
+ * and offsets as the decoder) so the counts are exact.
+ *
+ * if symbols is set, symbol records are also decoded into it
+ * (everything else is skipped), which is all sn-nm needs.
+ */
+static void scan_unit(iter &it, iter end, unit_counts &counts, sn_unit *symbols = nullptr) {
+
+	int current = -1;
+
+	while (it < end) {
+		unsigned op = *it++;
+
+		switch(op) {
+		case 0x00:
+			if (it == end) return;
+			throw std::runtime_error("Unexpected EOF segment");
+
+		case 0x02: {
+			if (std::distance(it, end) < 2)
+				throw eof();
+			unsigned size = read_16(it);
+			if (std::distance(it, end) < size)
+				throw eof();
+			it += size;
+			if (current >= 0) counts.sections[current].data++;
+			break;
+		}
+		case 0x06: {
+			if (std::distance(it, end) < 2)
+				throw eof();
+			unsigned id = read_16(it);
+			current = -1;
+			for (unsigned i = 0; i < counts.sections.size(); ++i) {
+				if (counts.sections[i].section_id == id) {
+					current = i;
+					break;
+				}
+			}
+			break;
+		}
+		case 0x08:
+			if (std::distance(it, end) < 4)
+				throw eof();
+			it += 4;
+			if (current >= 0) counts.sections[current].data++;
+			break;
+		case 0x0a: {
+			// constant expressions are folded, so they don't need tokens.
+			unsigned n = 0;
+			bool constant;
+			it = skip_reloc(it, end, n, constant);
+			if (current < 0) break;
+			if (constant) counts.sections[current].patches++;
+			else {
+				counts.sections[current].relocs++;
+				counts.tokens += n;
+			}
+			break;
+		}
+		case 0x0c:
+			if (symbols) it = parse_global_symbol(it, end, symbols->globals.emplace_back());
+			else it = skip_pstring_record(it, end, 8);
+			counts.globals++;
+			break;
+		case 0x0e:
+			if (symbols) it = parse_extern_symbol(it, end, symbols->externs.emplace_back());
+			else it = skip_pstring_record(it, end, 2);
+			counts.externs++;
+			break;
+		case 0x12:
+			if (symbols) it = parse_local_symbol(it, end, symbols->locals.emplace_back());
+			else it = skip_pstring_record(it, end, 6);
+			counts.locals++;
+			break;
+		case 0x10: {
+			if (std::distance(it, end) < 2)
+				throw eof();
+			unsigned id = it[0] | (it[1] << 8);
+			it = skip_pstring_record(it, end, 5);
+			counts.sections.emplace_back().section_id = id;
+			break;
+		}
+		case 0x14:
+			it = skip_pstring_record(it, end, 3);
+			counts.groups++;
+			break;
+		case 0x1c:
+			it = skip_pstring_record(it, end, 2);
+			counts.files++;
+			break;
+		case 0x1e:
+			if (std::distance(it, end) < 6)
+				throw eof();
+			it += 6;
+			break;
+		case 0x22:
+			break;
+		case 0x24:
+			if (it == end) throw eof();
+			++it;
+			break;
+		case 0x2c:
+			if (std::distance(it, end) < 3)
+				throw eof();
+			it += 3;
+			break;
+		case 0x28:
+			it = skip_local_symbol(it, end);
+			break;
+		case 0x2a:
+		case 0x18:
+		case 0x16:
+			if (std::distance(it, end) < 7)
+				throw eof();
+			it += 7;
+			break;
+
+		default:
+			throw bad_opcode("Unknown opcode", op);
+		}
+	}
+	throw eof();
+}
+
+
+
+inline std::runtime_error parse_error(const std::string &path, const char *msg, long offset) {
+	char buffer[32];
+	snprintf(buffer, sizeof(buffer), " at offset $%lx", offset);
+
+	std::string tmp(path);
+	tmp.append(": ");
+	tmp.append(msg);
+	tmp.append(buffer);
+	return std::runtime_error(tmp);
+}
+
+/*
+ * pipes and stdin can't be mapped, so read them (in bounded chunks) into
+ * the unit's buffer.  section data and names point into it, just as they
+ * would point into the mapping, so it needs to hold the whole object.
+ */
+static void read_stream(const std::string &path, int fd, std::vector<uint8_t> &buffer) {
+
+	constexpr size_t chunk = 65536;
+
+	for(;;) {
+		size_t size = buffer.size();
+		buffer.resize(size + chunk);
+		auto n = read(fd, buffer.data() + size, chunk);
+		if (n < 0) {
+			if (errno == EINTR) {
+				buffer.resize(size);
+				continue;
+			}
+			throw std::runtime_error("Unable to read " + path + ": " + strerror(errno));
+		}
+		buffer.resize(size + n);
+		if (n == 0) break;
+	}
+}
+
+static void open_stream(const std::string &path, std::vector<uint8_t> &buffer) {
+
+	if (path == "-") return read_stream(path, STDIN_FILENO, buffer);
+
+	int fd = open(path.c_str(), O_RDONLY | O_BINARY);
+	if (fd < 0)
+		throw std::runtime_error("Unable to open " + path + ": " + strerror(errno));
+
+	try {
+		read_stream(path, fd, buffer);
+	} catch (...) {
+		close(fd);
+		throw;
+	}
+	close(fd);
+}
+
+bool sn_is_stream(const std::string &path) {
+	if (path == "-") return true;
 
+	struct stat st;
+	if (stat(path.c_str(), &st) < 0) return false;
+	return !S_ISREG(st.st_mode);
+}
 
-void sn_parse_unit(const std::string &path, sn_unit &unit) {
+/*
+ * throws std::runtime_error with the path and offset included in the message,
+ * so the caller can report it without any further context.
+ */
+static void parse_unit(const std::string &path, sn_unit &unit, unsigned flags) {
 
 	// if (verbose) printf("Linking %s\n", path.c_str());
 
+	// section data points into the mapping, so it lives as long as the unit.
+	// (it may already be open if the unit cache missed, or the unit may be a
+	// library member, which points into the library.)
+	// a fifo is only opened once, since opening it releases the writer.
 	std::error_code ec;
-	mapped_file mf(path, mapped_file::readonly, ec);
+	auto &mf = unit.mapping;
+	bool member = unit.member != nullptr;
+	bool stream = !member && !mf.is_open() && sn_is_stream(path);
+	if (!member && !stream && !mf.is_open()) mf.open(path, mapped_file::readonly, ec);
 	if (ec) {
-		errx(1, "Unable to open %s: %s", path.c_str(), ec.message().c_str());
+		throw std::runtime_error("Unable to open " + path + ": " + ec.message());
+	}
+
+	iter begin = mf.begin();
+	iter end = mf.end();
+	if (member) {
+		begin = unit.member;
+		end = begin + unit.member_size;
+	} else if (stream) {
+		open_stream(path, unit.buffer);
+		begin = unit.buffer.data();
+		end = begin + unit.buffer.size();
 	}
 
-	unsigned current_file = 0;
-	unsigned current_line = 0;
 	unsigned current_section = 0;
 	sn_section *current = nullptr;
 
 
 	unit.filename = path;
 
-	auto it = mf.begin();
-	auto end = mf.end();
+	auto it = begin;
 
-	if (std::distance(it, end) < 7) throw eof();
+	if (std::distance(it, end) < 7) throw parse_error(path, "Unexpected EOF", 0);
 
-	if (memcmp(it, "LNK\x02", 4)) throw std::runtime_error("Not an SN Object File");
+	if (memcmp(it, "LNK\x02", 4)) throw std::runtime_error(path + ": Not an SN Object File");
 	it += 6;
 
 	try {
+		// size everything up front.  section pointers remain valid since
+		// the sections vector never reallocates.
+		unit_counts counts;
+		auto start = it;
+
+		if (flags & SN_SYMBOLS_ONLY) {
+			scan_unit(it, end, counts, &unit);
+			unit.build_indexes();
+			return;
+		}
+
+		scan_unit(it, end, counts);
+		it = start;
+
+		unit.sections.reserve(counts.sections.size());
+		unit.groups.reserve(counts.groups);
+		unit.files.reserve(counts.files);
+		unit.locals.reserve(counts.locals);
+		unit.globals.reserve(counts.globals);
+		unit.externs.reserve(counts.externs);
+		unit.tokens.reserve(counts.tokens);
+
 		while (it < end) {
 			unsigned op = *it++;
 
 			switch(op) {
 			case 0x00:
-				if (it == end) return;
+				if (it == end) {
+					unit.build_indexes();
+					return;
+				}
 				throw std::runtime_error("Unexpected EOF segment");
 
 			case 0x02: {
@@ -357,7 +781,8 @@ void sn_parse_unit(const std::string &path, sn_unit &unit) {
 				unsigned size = read_16(it);
 				if (std::distance(it, end) < size)
 					throw eof();
-				append(current->data, it, it + size);
+				append(current->data, it, size);
+				current->size += size;
 				it += size;
 				break;
 			}
@@ -387,7 +812,8 @@ void sn_parse_unit(const std::string &path, sn_unit &unit) {
 					throw eof();
 
 				uint32_t size = read_32(it);
-				current->data.resize(current->data.size() + size, 0x00);
+				append(current->data, nullptr, size);
+				current->size += size;
 				// current->bss_size += size;
 				break;
 			}
@@ -395,10 +821,15 @@ void sn_parse_unit(const std::string &path, sn_unit &unit) {
 				if (!current)
 					throw std::runtime_error("No active section");
 
-				auto &reloc = current->relocs.emplace_back();
-				it = parse_reloc(it, end, reloc);
-				reloc.file_id = current_file;
-				reloc.line = current_line;
+				sn_patch patch;
+				if (auto next = fold_reloc(it, end, *current, patch)) {
+					current->patches.push_back(patch);
+					it = next;
+					break;
+				}
+
+				current->offsets.push_back(std::distance(begin, it) - 1);
+				it = parse_reloc(it, end, current->relocs.emplace_back(), unit.tokens);
 				break;
 			}
 			case 0x0c: {
@@ -423,19 +854,13 @@ void sn_parse_unit(const std::string &path, sn_unit &unit) {
 			}
 
 			case 0x10: {
+				const auto &c = counts.sections[unit.sections.size()];
 				auto &section = unit.sections.emplace_back();
+				section.data.reserve(c.data);
+				section.relocs.reserve(c.relocs);
+				section.offsets.reserve(c.relocs);
+				section.patches.reserve(c.patches);
 				it = parse_section(it, end, section);
-
-				// re-calc current section since it may have re-allocated.
-				if (current) {
-					current = nullptr;
-					for (auto &s : unit.sections) {
-						if (s.section_id == current_section) {
-							current = &s;
-							break;
-						}
-					}	
-				}
 				break;
 			}
 
@@ -450,20 +875,17 @@ void sn_parse_unit(const std::string &path, sn_unit &unit) {
 				break;
 			}
 
-			case 0x1e: {
+			// line numbers are only needed for diagnostics -- see sn_source_line.
+			case 0x1e:
 				if (std::distance(it, end) < 6)
 					throw eof();
-				// set the line number.
-				current_file = read_16(it);
-				current_line = read_32(it);
+				it += 6;
 				break;
-			}
 			case 0x22:
-				current_line++;
 				break;
 			case 0x24:
-				if (it == end) eof();
-				current_line += *it++;
+				if (it == end) throw eof();
+				++it;
 				break;
 			case 0x2c: {
 				// unknown /z file record.
@@ -497,6 +919,81 @@ void sn_parse_unit(const std::string &path, sn_unit &unit) {
 
 		throw eof();
 	} catch (std::runtime_error &e) {
-		errx(1, "%s: %s at offset $%lx", path.c_str(), e.what(), std::distance(mf.begin(), it) - 1);
+		throw parse_error(path, e.what(), std::distance(begin, it) - 1);
+	}
+}
+
+/*
+ * relocations only record their offset.  the file and line are
+ * reconstructed here by replaying the records before it, which
+ * were validated when the unit was parsed.
+ */
+void sn_source_line(const sn_unit &unit, uint32_t offset, unsigned &file_id, unsigned &line) {
+
+	file_id = 0;
+	line = 0;
+
+	iter begin = unit.object_data();
+	iter end = begin + unit.object_size();
+	iter it = begin + 6;
+	iter target = begin + offset;
+
+	while (it < target) {
+		unsigned op = *it++;
+		unsigned n = 0;
+		bool constant;
+
+		switch(op) {
+		case 0x1e:
+			file_id = read_16(it);
+			line = read_32(it);
+			break;
+		case 0x22:
+			line++;
+			break;
+		case 0x24:
+			line += *it++;
+			break;
+
+		case 0x02: {
+			unsigned size = read_16(it);
+			it += size;
+			break;
+		}
+		case 0x06: it += 2; break;
+		case 0x08: it += 4; break;
+		case 0x0a: it = skip_reloc(it, end, n, constant); break;
+		case 0x0c: it = skip_pstring_record(it, end, 8); break;
+		case 0x0e: it = skip_pstring_record(it, end, 2); break;
+		case 0x12: it = skip_pstring_record(it, end, 6); break;
+		case 0x10: it = skip_pstring_record(it, end, 5); break;
+		case 0x14: it = skip_pstring_record(it, end, 3); break;
+		case 0x1c: it = skip_pstring_record(it, end, 2); break;
+		case 0x2c: it += 3; break;
+		case 0x28: it = skip_local_symbol(it, end); break;
+		case 0x2a:
+		case 0x18:
+		case 0x16:
+			it += 7;
+			break;
+		}
+	}
+}
+
+void sn_parse_unit(const std::string &path, sn_unit &unit, unsigned flags) {
+	try {
+		parse_unit(path, unit, flags);
+	} catch (std::runtime_error &e) {
+		errx(1, "%s", e.what());
+	}
+}
+
+bool sn_parse_unit(const std::string &path, sn_unit &unit, std::string &error, unsigned flags) {
+	try {
+		parse_unit(path, unit, flags);
+	} catch (std::runtime_error &e) {
+		error = e.what();
+		return false;
 	}
+	return true;
 }
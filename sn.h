@@ -1,9 +1,18 @@
 #include <vector>
 #include <string>
+#include <string_view>
+#include <memory>
+#include <memory_resource>
 #include <cstdint>
 
+#include "mapped_file.h"
+
+// name_id fields are assigned by the linker's string pool after parsing.
+// names point into the unit's object file data.
+
 struct sn_group {
-	std::string name;
+	std::string_view name;
+	unsigned name_id = 0;
 	unsigned group_id = 0;
 	unsigned flags = 0;
 
@@ -18,7 +27,8 @@ struct sn_group {
 };
 
 struct sn_file {
-	std::string name;
+	std::string_view name;
+	unsigned name_id = 0;
 	unsigned file_id = 0;
 
 	bool operator==(const std::string &s) const {
@@ -31,16 +41,42 @@ struct expr_token {
 	uint32_t value = 0; // constant, extern symbol id, or section id
 };
 
+// a relocation's expression tokens (a range of sn_unit::tokens)
+template<class T>
+struct sn_token_range {
+	T *first = nullptr;
+	unsigned count = 0;
+
+	T *begin() const { return first; }
+	T *end() const { return first + count; }
+	unsigned size() const { return count; }
+	bool empty() const { return count == 0; }
+	T &front() const { return *first; }
+	T &operator[](unsigned i) const { return first[i]; }
+};
+
+typedef sn_token_range<expr_token> sn_expr;
+typedef sn_token_range<const expr_token> sn_const_expr;
+
+// the fields the linker walks.  the record's offset is kept in sn_section::offsets.
 struct sn_reloc {
-	unsigned type = 0;
 	uint32_t address = 0;
-	unsigned file_id = 0;
-	unsigned line = 0;
-	std::vector<expr_token> expr;
+	uint32_t expr_offset = 0; // index into sn_unit::tokens
+	uint16_t expr_size = 0;
+	uint8_t type = 0;
+};
+
+// a relocation with a constant value, folded when the unit was decoded.
+// it's applied when the section data is copied into its segment.
+struct sn_patch {
+	uint32_t address = 0;
+	uint32_t value = 0;
+	unsigned size = 0;
 };
 
 struct sn_symbol {
-	std::string name;
+	std::string_view name; // points into the unit's object file data
+	unsigned name_id = 0;
 	unsigned symbol_id = 0;
 	unsigned section_id = 0;
 	uint32_t value = 0;
@@ -51,8 +87,22 @@ struct sn_symbol {
 
 };
 
+// a run of section data.  data points into the unit's mapped object file
+// (or its buffer); nullptr is reserved space (ds), which is zero-filled.
+struct sn_data {
+	const uint8_t *data = nullptr;
+	uint32_t size = 0;
+};
+
+/*
+ * sections are allocated from the unit's arena, and so are their vectors
+ * (the allocator is passed along by the unit's sections vector).
+ */
 struct sn_section {
-	std::string name;
+	typedef std::pmr::polymorphic_allocator<std::byte> allocator_type;
+
+	std::string_view name;
+	unsigned name_id = 0;
 	unsigned section_id = 0;
 	unsigned group_id = 0;
 	unsigned flags = 0;
@@ -62,12 +112,29 @@ struct sn_section {
 	// 2 = 8-bit alignment
 
 	unsigned bss_size = 0;
-	std::vector<uint8_t> data;
-	std::vector<sn_reloc> relocs;
+	uint32_t size = 0; // total of all data runs
+	std::pmr::vector<sn_data> data;
+	std::pmr::vector<sn_reloc> relocs;
+	std::pmr::vector<uint32_t> offsets; // object file offset of each reloc record
+	std::pmr::vector<sn_patch> patches;
 
 	// omf-data
 	unsigned segnum = 0;
 	uint32_t offset = 0;
+	unsigned layout_id = 0; // set by the linker
+	sn_section *folded = nullptr; // identical to this section, which is placed instead
+	uint64_t heat = 0; // profile samples (-p)
+
+	sn_section() = default;
+	sn_section(const sn_section &) = default;
+	sn_section(sn_section &&) = default;
+
+	explicit sn_section(const allocator_type &a) : data(a), relocs(a), offsets(a), patches(a) {}
+	sn_section(const sn_section &rhs, const allocator_type &a) : sn_section(a) { *this = rhs; }
+	sn_section(sn_section &&rhs, const allocator_type &a) : sn_section(a) { *this = std::move(rhs); }
+
+	sn_section &operator=(const sn_section &) = default;
+	sn_section &operator=(sn_section &&) = default;
 
 
 	bool operator==(const std::string &s) const {
@@ -75,15 +142,61 @@ struct sn_section {
 	}
 };
 
+// maps a unit's 16-bit record ids to vector indices.
+struct sn_index {
+	unsigned base = 0;
+	std::pmr::vector<unsigned> table; // index + 1, 0 = not present.
+
+	explicit sn_index(std::pmr::memory_resource *r) : table(r) {}
+
+	int find(unsigned id) const {
+		id -= base;
+		if (id >= table.size()) return -1;
+		return (int)table[id] - 1;
+	}
+};
+
 struct sn_unit {
 	// translation unit.
 	std::string filename;
-	std::vector<sn_section> sections;
-	std::vector<sn_group> groups;
-	std::vector<sn_file> files;
-	std::vector<sn_symbol> locals;
-	std::vector<sn_symbol> globals;
-	std::vector<sn_symbol> externs;
+	mapped_file mapping; // section data references this, so keep it open.
+	std::vector<uint8_t> buffer; // (or this, if it was read from a pipe.)
+
+	// (or a library member, in the library's mapping, which library keeps open.)
+	std::shared_ptr<const mapped_file> library;
+	const uint8_t *member = nullptr;
+	size_t member_size = 0;
+
+	// everything decoded lives in the arena, which is released all at once.
+	// (declared before the vectors, so it outlives them.)
+	std::unique_ptr<std::pmr::monotonic_buffer_resource> arena = std::make_unique<std::pmr::monotonic_buffer_resource>();
+
+	std::pmr::vector<sn_section> sections{arena.get()};
+	std::pmr::vector<sn_group> groups{arena.get()};
+	std::pmr::vector<sn_file> files{arena.get()};
+	std::pmr::vector<sn_symbol> locals{arena.get()};
+	std::pmr::vector<sn_symbol> globals{arena.get()};
+	std::pmr::vector<sn_symbol> externs{arena.get()};
+
+	// expression tokens for every relocation in the unit.
+	std::pmr::vector<expr_token> tokens{arena.get()};
+
+	sn_expr expr(const sn_reloc &r) {
+		return sn_expr{ tokens.data() + r.expr_offset, r.expr_size };
+	}
+	sn_const_expr expr(const sn_reloc &r) const {
+		return sn_const_expr{ tokens.data() + r.expr_offset, r.expr_size };
+	}
+
+	// built once parsing finishes.
+	sn_index section_index{arena.get()};
+	sn_index group_index{arena.get()};
+	sn_index extern_index{arena.get()};
+
+	sn_unit() = default;
+	sn_unit(sn_unit &&) = default;
+	// the vectors can't be moved to another unit's arena.
+	sn_unit &operator=(sn_unit &&) = delete;
 
 	sn_file *find_file(const std::string &name);
 	sn_file *find_file(unsigned id);
@@ -100,6 +213,21 @@ struct sn_unit {
 	sn_symbol *find_extern(const std::string &name);
 	sn_symbol *find_extern(unsigned id);
 
+	void build_indexes();
+
+	// the object file data (mapped, a library member, or read from a pipe).
+	const uint8_t *object_data() const {
+		if (mapping.is_open()) return mapping.data();
+		return member ? member : buffer.data();
+	}
+	size_t object_size() const {
+		if (mapping.is_open()) return mapping.size();
+		return member ? member_size : buffer.size();
+	}
+
+	// discard everything decoded (the mapping, member and buffer remain).
+	void clear();
+
 
 };
 
@@ -154,4 +282,30 @@ enum {
 
 
 
-void sn_parse_unit(const std::string &path, sn_unit &unit);
+enum {
+	// sn_parse_unit flags
+	SN_SYMBOLS_ONLY = 1, // only decode global, extern and local symbols
+};
+
+
+// if unit.member is set (a library member), it's parsed instead of path.
+void sn_parse_unit(const std::string &path, sn_unit &unit, unsigned flags = 0);
+
+// stdin ("-"), pipes and fifos.  checked without opening the file, since
+// opening a fifo would let the writer start.
+bool sn_is_stream(const std::string &path);
+
+// source file id and line number in effect at a record offset (eg, sn_section::offsets).
+// these are found by replaying the line records, so only use it for diagnostics.
+void sn_source_line(const sn_unit &unit, uint32_t offset, unsigned &file_id, unsigned &line);
+
+// evaluate a binary expression operator (OP_ADD, etc) with constant operands.
+uint32_t sn_eval(unsigned op, uint32_t a, uint32_t b);
+
+// non-exiting version -- returns false and sets error (safe to use from a worker thread).
+bool sn_parse_unit(const std::string &path, sn_unit &unit, std::string &error, unsigned flags = 0);
+
+// parsed unit cache (cache.cpp), keyed by the object file's contents.
+// sn_cache_load maps the object file; on a miss, it's left open for sn_parse_unit.
+bool sn_cache_load(const std::string &dir, const std::string &path, sn_unit &unit);
+void sn_cache_save(const std::string &dir, const sn_unit &unit);
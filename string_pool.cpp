@@ -0,0 +1,57 @@
+#include "string_pool.h"
+
+#include <functional>
+
+string_pool::string_pool() {
+	_table.resize(256);
+	intern(std::string_view());
+}
+
+unsigned string_pool::find(std::string_view s) const {
+
+	size_t h = std::hash<std::string_view>{}(s);
+	size_t mask = _table.size() - 1;
+
+	for (size_t i = h & mask; ; i = (i + 1) & mask) {
+		unsigned x = _table[i];
+		if (!x) return 0;
+		--x;
+		if (_hashes[x] == h && _strings[x] == s) return x;
+	}
+}
+
+unsigned string_pool::intern(std::string_view s) {
+
+	size_t h = std::hash<std::string_view>{}(s);
+	size_t mask = _table.size() - 1;
+
+	size_t i;
+	for (i = h & mask; ; i = (i + 1) & mask) {
+		unsigned x = _table[i];
+		if (!x) break;
+		--x;
+		if (_hashes[x] == h && _strings[x] == s) return x;
+	}
+
+	unsigned id = _strings.size();
+	_strings.emplace_back(s);
+	_hashes.push_back(h);
+	_table[i] = id + 1;
+
+	// keep the load factor under 1/2.
+	if (_strings.size() * 2 > _table.size()) grow();
+	return id;
+}
+
+void string_pool::grow() {
+
+	std::vector<unsigned> tmp(_table.size() * 2);
+	size_t mask = tmp.size() - 1;
+
+	for (unsigned id = 0; id < _strings.size(); ++id) {
+		size_t i = _hashes[id] & mask;
+		while (tmp[i]) i = (i + 1) & mask;
+		tmp[i] = id + 1;
+	}
+	_table.swap(tmp);
+}
@@ -0,0 +1,46 @@
+#ifndef __string_pool_h__
+#define __string_pool_h__
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <deque>
+#include <cstddef>
+
+/*
+ * link-wide string interning.
+ *
+ * every distinct string gets a dense, stable id (0 is always the empty
+ * string) so names can be compared as integers.  the hash is computed once,
+ * when the string is first interned, and reused when the table grows.
+ */
+class string_pool {
+public:
+
+	string_pool();
+	string_pool(const string_pool &) = delete;
+	string_pool &operator=(const string_pool &) = delete;
+
+	unsigned intern(std::string_view s);
+
+	// returns 0 if s has not been interned (which is also the id of "")
+	unsigned find(std::string_view s) const;
+
+	const std::string &operator[](unsigned id) const {
+		return _strings[id];
+	}
+
+	size_t size() const {
+		return _strings.size();
+	}
+
+private:
+
+	void grow();
+
+	std::deque<std::string> _strings;
+	std::vector<size_t> _hashes; // by id, for grow() and to skip most string compares
+	std::vector<unsigned> _table; // open addressing, id + 1 (0 = empty)
+};
+
+#endif
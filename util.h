@@ -0,0 +1,70 @@
+#ifndef __util_h__
+#define __util_h__
+
+#include <cstdint>
+#include <cstddef>
+
+#include <fcntl.h>
+
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+
+/*
+ * little endian readers.  iter is advanced past the value.
+ */
+template<class T>
+uint8_t read_8(T &iter) {
+	uint8_t tmp = *iter;
+	++iter;
+	return tmp;
+}
+
+template<class T>
+uint16_t read_16(T &iter) {
+	uint16_t tmp = 0;
+
+	tmp |= *iter << 0;
+	++iter;
+	tmp |= *iter << 8;
+	++iter;
+	return tmp;
+}
+
+template<class T>
+uint32_t read_32(T &iter) {
+	uint32_t tmp = 0;
+
+	tmp |= *iter << 0;
+	++iter;
+	tmp |= *iter << 8;
+	++iter;
+	tmp |= *iter << 16;
+	++iter;
+	tmp |= (uint32_t)*iter << 24;
+	++iter;
+
+	return tmp;
+}
+
+/*
+ * FNV-1a.  h is the offset basis or the hash so far; its type selects
+ * the 32 or 64 bit version.
+ */
+constexpr uint32_t fnv32_basis = 0x811c9dc5;
+constexpr uint64_t fnv64_basis = 0xcbf29ce484222325;
+
+template<class T>
+T fnv1a(const void *data, size_t size, T h) {
+	static_assert(sizeof(T) == 4 || sizeof(T) == 8, "32 or 64 bit hash");
+	constexpr T prime = sizeof(T) == 8 ? (T)0x100000001b3 : (T)0x01000193;
+
+	auto p = (const uint8_t *)data;
+	for (size_t i = 0; i < size; ++i) {
+		h ^= p[i];
+		h *= prime;
+	}
+	return h;
+}
+
+#endif